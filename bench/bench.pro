@@ -0,0 +1,59 @@
+######################################################################
+# Benchmarks of qMemo, built apart from the application:
+#
+#   qmake bench/bench.pro && make
+#   QT_QPA_PLATFORM=offscreen ./qmemo-bench -o results.csv,csv
+#
+# Any output format of QtTest can be chosen, e.g. -o results.xml,xml,
+# so results of two builds can be compared. A single size is run with
+# e.g. ./qmemo-bench storeList:packed:100k, and the 1M notes, which
+# take long to write, with e.g. ./qmemo-bench dataHandlerConstruction:packed:1M.
+######################################################################
+
+TEMPLATE = app
+TARGET = qmemo-bench
+INCLUDEPATH += ../src
+
+QT += widgets core concurrent testlib
+
+CONFIG += release
+
+HEADERS += ../src/archivestore.hpp \
+           ../src/datahandler.hpp \
+           ../src/directorystore.hpp \
+           ../src/editjournal.hpp \
+           ../src/fileindex.hpp \
+           ../src/fileinfomodel.hpp \
+           ../src/fileinfoproxy.hpp \
+           ../src/filescanner.hpp \
+           ../src/fileworker.hpp \
+           ../src/grepsearch.hpp \
+           ../src/notefile.hpp \
+           ../src/notehistory.hpp \
+           ../src/notestore.hpp \
+           ../src/packedstore.hpp \
+           ../src/searchindex.hpp \
+           ../src/gui/previewdelegate.hpp
+
+SOURCES += benchmark.cpp \
+           ../src/archivestore.cpp \
+           ../src/datahandler.cpp \
+           ../src/directorystore.cpp \
+           ../src/editjournal.cpp \
+           ../src/fileindex.cpp \
+           ../src/fileinfomodel.cpp \
+           ../src/fileinfoproxy.cpp \
+           ../src/filescanner.cpp \
+           ../src/fileworker.cpp \
+           ../src/grepsearch.cpp \
+           ../src/notefile.cpp \
+           ../src/notehistory.cpp \
+           ../src/notestore.cpp \
+           ../src/packedstore.cpp \
+           ../src/searchindex.cpp \
+           ../src/gui/previewdelegate.cpp
+
+DEFINES += QT_NO_DEBUG_OUTPUT
+
+OBJECTS_DIR = .obj
+MOC_DIR = .moc
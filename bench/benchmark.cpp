@@ -0,0 +1,607 @@
+// qMemo/benchmark.cpp - benchmarks of storage, model and rendering
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QMap>
+#include <QPainter>
+#include <QPixmapCache>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QSignalSpy>
+#include <QStyleOptionViewItem>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "datahandler.hpp"
+#include "fileinfomodel.hpp"
+#include "fileinfoproxy.hpp"
+#include "notefile.hpp"
+#include "notestore.hpp"
+#include "searchindex.hpp"
+#include "gui/previewdelegate.hpp"
+
+
+// Every benchmark runs on synthetic notes, 1k, 10k and 100k of them,
+// written once into a temporary home directory and shared by the
+// benchmarks. A tenth of the notes are archived. Each store gets a home
+// of its own, as a packed store moves the notes away when it imports
+// them. The stores are compared at 1M notes as well, which takes a few
+// gigabytes of disk for each home. Large notes and the memory of the
+// model are measured apart.
+class Benchmark : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void cleanupTestCase();
+
+  void dataHandlerConstruction_data();
+  void dataHandlerConstruction();
+  void loadCurrentFile_data();
+  void loadCurrentFile();
+  void saveCurrentFile_data();
+  void saveCurrentFile();
+  void modifyItem_data();
+  void modifyItem();
+  void removeItem_data();
+  void removeItem();
+  void removeItems_data();
+  void removeItems();
+  void proxySort_data();
+  void proxySort();
+  void search_data();
+  void search();
+  void previewDelegatePaint_data();
+  void previewDelegatePaint();
+  void storeList_data();
+  void storeList();
+  void storeLoad_data();
+  void storeLoad();
+  void loadLargeNote_data();
+  void loadLargeNote();
+  void modelMemory_data();
+  void modelMemory();
+
+private:
+  QString homeOf(int count, const QString& owner = QString());
+  QString handlerHomeOf(const QString& type, int count);
+  NoteStore* storeOf(const QString& type, int count);
+  void fillModel(FileInfoModel* model, int count);
+  FileInfoModel* waitForList(DataHandler* handler, int count);
+
+  static void addCounts();
+  static void addStoreRows();
+  static QByteArray textOf(int note);
+  static QByteArray textOfSize(int size);
+
+  QMap<QString, QSharedPointer<QTemporaryDir>> mHomes;
+  QMap<QString, QSharedPointer<NoteStore>> mStores;
+};
+
+
+// Words are picked by a fixed sequence, so every run writes the same
+// notes, of a few hundred bytes to a few kilobytes.
+QByteArray Benchmark::textOf(int note)
+{
+  static const char* const WORDS[] {
+    "memo", "note", "meeting", "idea", "todo", "draft", "list", "qt",
+    "archive", "search", "index", "review", "plan", "call", "buy", "read"
+  };
+
+  quint32 state { static_cast<quint32>(note) * 2654435761u + 1 };
+  int words { 40 + static_cast<int>(state % 400) };
+  QByteArray text { "Note " + QByteArray::number(note) + "\n" };
+
+  for (int i { 0 }; i < words; ++i) {
+    state = state * 1664525u + 1013904223u;
+    text += WORDS[state >> 28];
+    text += (state & 0xf) == 0 ? '\n' : ' ';
+  }
+
+  return text;
+}
+
+// The notes one after another, cut at the size.
+QByteArray Benchmark::textOfSize(int size)
+{
+  QByteArray text;
+  text.reserve(size);
+
+  for (int note { 0 }; text.size() < size; ++note) {
+    text += textOf(note);
+  }
+
+  text.truncate(size);
+  return text;
+}
+
+QString Benchmark::homeOf(int count, const QString& owner)
+{
+  QString key { owner + QString::number(count) };
+
+  if (mHomes.contains(key)) return mHomes.value(key)->path();
+
+  QSharedPointer<QTemporaryDir> home { new QTemporaryDir };
+  QDir dir { home->path() };
+  dir.mkpath(".memo/archive");
+  qint64 time { QDateTime::currentMSecsSinceEpoch() - count * 1000LL };
+
+  for (int note { 0 }; note < count; ++note) {
+    QString name { QString::number(time + note * 1000LL) + ".txt" };
+    QFile file { dir.filePath(note % 10 == 0 ? ".memo/archive/" + name : ".memo/" + name) };
+
+    if (!file.open(QIODevice::WriteOnly) || file.write(textOf(note)) < 0) {
+      qFatal("Failed to write a note: Benchmark::homeOf()");
+    }
+  }
+
+  mHomes.insert(key, home);
+  return home->path();
+}
+
+// A DataHandler of the packed store imports the notes of its home on
+// the first start, so it gets a home of its own as well.
+QString Benchmark::handlerHomeOf(const QString& type, int count)
+{
+  return homeOf(count, type == "directory" ? QString() : "handler-" + type);
+}
+
+// A store of each type is made once for every size, in a home of its
+// own, and a packed store imports the notes then.
+NoteStore* Benchmark::storeOf(const QString& type, int count)
+{
+  QString key { type + QString::number(count) };
+
+  if (!mStores.contains(key)) {
+    QDir home { homeOf(count, type) };
+    home.mkpath("bench-" + type);
+    QList<QDir> noteDirectories { QDir(home.filePath(".memo")), QDir(home.filePath(".memo/archive")) };
+    mStores.insert(key, QSharedPointer<NoteStore>(NoteStore::create(type, noteDirectories,
+								     QDir(home.filePath("bench-" + type)))));
+  }
+
+  return mStores.value(key).data();
+}
+
+// Entries as a scan finds them, without touching the disk, the newest
+// one first.
+void Benchmark::fillModel(FileInfoModel* model, int count)
+{
+  QVector<IndexEntry> entries;
+  entries.reserve(count);
+  qint64 time { QDateTime::currentMSecsSinceEpoch() };
+
+  for (int note { 0 }; note < count; ++note) {
+    QByteArray text { textOf(note) };
+    entries.append(IndexEntry { QString::number(time - note * 1000LL) + ".txt", text.size(), time - note * 1000LL,
+				NoteFile::previewOf(text.constData(), text.size()) });
+  }
+
+  model->appendItems(QDir("/notes"), entries);
+}
+
+// Returns the active list once every active note is in it.
+FileInfoModel* Benchmark::waitForList(DataHandler* handler, int count)
+{
+  QSignalSpy spy { handler, &DataHandler::fileListSwitched };
+  handler->setActiveMode(true);
+
+  FileInfoModel* list { spy.first().first().value<FileInfoModel*>() };
+  int expected { count - (count + 9) / 10 };
+  QElapsedTimer timer;
+  timer.start();
+
+  while (list->rowCount() < expected && timer.elapsed() < 600000) {
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+  }
+
+  return list;
+}
+
+void Benchmark::addCounts()
+{
+  QTest::addColumn<int>("count");
+  QTest::newRow("1k") << 1000;
+  QTest::newRow("10k") << 10000;
+  QTest::newRow("100k") << 100000;
+}
+
+void Benchmark::addStoreRows()
+{
+  QTest::addColumn<QString>("type");
+  QTest::addColumn<int>("count");
+
+  for (const auto& type : NoteStore::types()) {
+    for (int count : { 1000, 10000, 100000 }) {
+      QTest::newRow(qPrintable(QString("%1:%2k").arg(type).arg(count / 1000))) << type << count;
+    }
+
+    QTest::newRow(qPrintable(QString("%1:1M").arg(type))) << type << 1000000;
+  }
+}
+
+void Benchmark::cleanupTestCase()
+{
+  mStores.clear();
+  mHomes.clear();
+}
+
+void Benchmark::dataHandlerConstruction_data()
+{
+  addStoreRows();
+}
+
+// From the start to a complete list of the active notes. The first
+// iteration lists the notes from the files, or packs them, and the later
+// ones find the index which it saved, as a second start of the
+// application does.
+void Benchmark::dataHandlerConstruction()
+{
+  QFETCH(QString, type);
+  QFETCH(int, count);
+  qputenv("HOME", handlerHomeOf(type, count).toLocal8Bit());
+  int expected { count - (count + 9) / 10 };
+
+  QBENCHMARK {
+    DataHandler handler { type, DataHandler::KeepPacking };
+    QCOMPARE(waitForList(&handler, count)->rowCount(), expected);
+  }
+}
+
+void Benchmark::loadCurrentFile_data()
+{
+  addCounts();
+}
+
+// Every iteration loads the next note of the list, so the note cache
+// answers only once the whole list has been loaded.
+void Benchmark::loadCurrentFile()
+{
+  QFETCH(int, count);
+  qputenv("HOME", homeOf(count).toLocal8Bit());
+  DataHandler handler { "directory", DataHandler::KeepPacking };
+  FileInfoModel* list { waitForList(&handler, count) };
+  QSignalSpy spy { &handler, &DataHandler::fileLoaded };
+  int row { 0 };
+
+  QBENCHMARK {
+    handler.selectFile(row++ % list->rowCount());
+    spy.clear();
+    handler.loadCurrentFile();
+
+    if (spy.isEmpty()) QVERIFY(spy.wait(10000));
+  }
+}
+
+void Benchmark::saveCurrentFile_data()
+{
+  addStoreRows();
+}
+
+// Until the note is on the disk and the list shows the change.
+void Benchmark::saveCurrentFile()
+{
+  QFETCH(QString, type);
+  QFETCH(int, count);
+  qputenv("HOME", handlerHomeOf(type, count).toLocal8Bit());
+  DataHandler handler { type, DataHandler::KeepPacking };
+  waitForList(&handler, count);
+  handler.selectFile(0);
+  QString text { QString::fromUtf8(textOf(0)) };
+  int edit { 0 };
+
+  QBENCHMARK {
+    QVERIFY(handler.saveCurrentFile(text + QString::number(edit++)));
+    handler.flush();
+  }
+}
+
+void Benchmark::modifyItem_data()
+{
+  QTest::addColumn<int>("count");
+  QTest::addColumn<int>("depth");
+
+  for (int count : { 1000, 10000, 100000 }) {
+    for (int depth : { 10, count / 2, count - 1 }) {
+      QTest::newRow(qPrintable(QString("%1k:row%2").arg(count / 1000).arg(depth))) << count << depth;
+    }
+  }
+}
+
+// A saved note moves to the top of the sorted list, always from the same
+// depth, as the proxy renumbers the rows which the note passes.
+void Benchmark::modifyItem()
+{
+  QFETCH(int, count);
+  QFETCH(int, depth);
+  FileInfoModel model;
+  fillModel(&model, count);
+  FileInfoProxy proxy;
+  proxy.setSourceModel(&model);
+  qint64 modified { QDateTime::currentMSecsSinceEpoch() };
+
+  QBENCHMARK {
+    int current { proxy.mapToSource(proxy.index(depth, 0)).row() };
+    model.modifyItem(model.fileURL(current), ++modified, model.size(current), model.previewBytes(current));
+  }
+}
+
+void Benchmark::removeItem_data()
+{
+  addCounts();
+}
+
+// The top row, the newest note, which is the one most often deleted.
+// The note is appended again in the same iteration, so that the list
+// keeps its size.
+void Benchmark::removeItem()
+{
+  QFETCH(int, count);
+  FileInfoModel model;
+  fillModel(&model, count);
+  FileInfoProxy proxy;
+  proxy.setSourceModel(&model);
+
+  QBENCHMARK {
+    int row { 0 };
+    QUrl url { model.fileURL(row) };
+    qint64 modified { model.modifiedTime(row) };
+    qint64 size { model.size(row) };
+    QByteArray preview { model.previewBytes(row) };
+    model.removeItem(url);
+    model.appendItem(url, modified, size, preview);
+  }
+}
+
+void Benchmark::removeItems_data()
+{
+  addCounts();
+}
+
+// A hundredth of the notes, spread over the list, as a batch move takes
+// them, and appended again in the same iteration.
+void Benchmark::removeItems()
+{
+  QFETCH(int, count);
+  FileInfoModel model;
+  fillModel(&model, count);
+  FileInfoProxy proxy;
+  proxy.setSourceModel(&model);
+
+  QBENCHMARK {
+    QList<QUrl> urls;
+    QVector<IndexEntry> entries;
+
+    for (int row { 0 }; row < count; row += 100) {
+      urls.append(model.fileURL(row));
+      entries.append(IndexEntry { urls.last().fileName(), model.size(row), model.modifiedTime(row), model.previewBytes(row) });
+    }
+
+    QCOMPARE(model.removeItems(urls), urls.count());
+    model.appendItems(QDir("/notes"), entries);
+  }
+}
+
+void Benchmark::proxySort_data()
+{
+  QTest::addColumn<int>("mode");
+  QTest::addColumn<int>("count");
+
+  const char* const MODES[] { "modified", "created", "title", "size" };
+
+  for (int mode { FileInfoProxy::ModifiedOrder }; mode <= FileInfoProxy::SizeOrder; ++mode) {
+    for (int count : { 1000, 10000, 100000 }) {
+      QTest::newRow(qPrintable(QString("%1:%2k").arg(MODES[mode]).arg(count / 1000))) << mode << count;
+    }
+  }
+}
+
+// The list is sorted from the other end in every iteration.
+void Benchmark::proxySort()
+{
+  QFETCH(int, mode);
+  QFETCH(int, count);
+  FileInfoModel model;
+  fillModel(&model, count);
+  FileInfoProxy proxy;
+  proxy.setSourceModel(&model);
+  proxy.setSortMode(static_cast<FileInfoProxy::SortMode>(mode));
+  bool isAscending { false };
+
+  QBENCHMARK {
+    isAscending = !isAscending;
+    proxy.sort(0, isAscending ? Qt::AscendingOrder : Qt::DescendingOrder);
+  }
+}
+
+void Benchmark::search_data()
+{
+  QTest::addColumn<QString>("query");
+  QTest::addColumn<int>("count");
+
+  // nearly every note has the common word, and a single one the number
+  for (const auto& query : { "meeting", "note 42" }) {
+    for (int count : { 1000, 10000, 100000 }) {
+      QTest::newRow(qPrintable(QString("%1:%2k").arg(query).arg(count / 1000))) << QString(query) << count;
+    }
+  }
+}
+
+// A keystroke of the word search, from the query to the filtered list,
+// which should take less than 10 ms.
+void Benchmark::search()
+{
+  QFETCH(QString, query);
+  QFETCH(int, count);
+  FileInfoModel model;
+  fillModel(&model, count);
+  QVector<TokenizedNote> notes;
+  notes.reserve(count);
+
+  for (int row { 0 }; row < count; ++row) {
+    notes.append(TokenizedNote { model.filePath(row), true, SearchIndex::tokenize(QString::fromUtf8(textOf(row))) });
+  }
+
+  SearchIndex index;
+  index.apply(notes);
+  FileInfoProxy proxy;
+  proxy.setSourceModel(&model);
+
+  QBENCHMARK {
+    proxy.setAcceptedFiles(index.search(query));
+  }
+
+  QVERIFY(proxy.rowCount() > 0);
+}
+
+void Benchmark::previewDelegatePaint_data()
+{
+  QTest::addColumn<bool>("isCached");
+  QTest::newRow("cached") << true;
+  QTest::newRow("uncached") << false;
+}
+
+// A screenful of rows into an offscreen image, drawn from the pixmap
+// cache or laid out anew.
+void Benchmark::previewDelegatePaint()
+{
+  QFETCH(bool, isCached);
+  static const int ROWS { 12 };
+  static const int WIDTH { 300 };
+
+  FileInfoModel model;
+  fillModel(&model, ROWS);
+  PreviewDelegate delegate;
+  QImage image { WIDTH, ROWS * 56, QImage::Format_ARGB32_Premultiplied };
+  QStyleOptionViewItem option;
+  QPixmapCache::clear();
+
+  QBENCHMARK {
+    if (!isCached) QPixmapCache::clear();
+
+    QPainter painter { &image };
+
+    for (int row { 0 }; row < ROWS; ++row) {
+      QModelIndex index { model.index(row) };
+      option.rect = QRect(0, row * 56, WIDTH, delegate.sizeHint(option, index).height());
+      delegate.paint(&painter, option, index);
+    }
+  }
+}
+
+void Benchmark::storeList_data()
+{
+  addStoreRows();
+}
+
+// A listing without an index, as the first scan does.
+void Benchmark::storeList()
+{
+  QFETCH(QString, type);
+  QFETCH(int, count);
+  NoteStore* store { storeOf(type, count) };
+  QDir dir { QDir(homeOf(count, type)).filePath(".memo") };
+  int expected { count - (count + 9) / 10 };
+
+  QBENCHMARK {
+    QCOMPARE(store->list(dir).count(), expected);
+  }
+}
+
+void Benchmark::storeLoad_data()
+{
+  addStoreRows();
+}
+
+void Benchmark::storeLoad()
+{
+  QFETCH(QString, type);
+  QFETCH(int, count);
+  NoteStore* store { storeOf(type, count) };
+  QDir dir { QDir(homeOf(count, type)).filePath(".memo") };
+  QStringList paths;
+
+  for (const auto& entry : store->list(dir)) {
+    paths.append(dir.filePath(entry.fileName));
+  }
+
+  int note { 0 };
+
+  QBENCHMARK {
+    QVERIFY(!store->load(paths.at(note++ % paths.count())).isEmpty());
+  }
+}
+
+void Benchmark::loadLargeNote_data()
+{
+  QTest::addColumn<QString>("type");
+  QTest::addColumn<int>("size");
+
+  for (const auto& type : NoteStore::types()) {
+    for (int megabytes : { 1, 50, 500 }) {
+      QTest::newRow(qPrintable(QString("%1:%2MB").arg(type).arg(megabytes))) << type << megabytes * 1024 * 1024;
+    }
+  }
+}
+
+// A single note in a store of its own, which is removed at the end, so
+// that only one large note is on the disk at a time.
+void Benchmark::loadLargeNote()
+{
+  QFETCH(QString, type);
+  QFETCH(int, size);
+  QTemporaryDir home;
+  QDir dir { home.path() };
+  dir.mkpath(".memo");
+  dir.mkpath("bench-" + type);
+  QScopedPointer<NoteStore> store { NoteStore::create(type, { QDir(dir.filePath(".memo")) },
+						      QDir(dir.filePath("bench-" + type))) };
+  QString path { dir.filePath(".memo/" + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".txt") };
+  QVERIFY(store->write(path, textOfSize(size), QDateTime::currentMSecsSinceEpoch()));
+
+  QBENCHMARK {
+    QCOMPARE(store->load(path).size(), size);
+  }
+}
+
+void Benchmark::modelMemory_data()
+{
+  QTest::addColumn<int>("count");
+  QTest::newRow("100k") << 100000;
+  QTest::newRow("1M") << 1000000;
+}
+
+// Bytes per note, reported as the result of the benchmark, so that it
+// is written in the chosen format with the timings.
+void Benchmark::modelMemory()
+{
+  QFETCH(int, count);
+  FileInfoModel model;
+  fillModel(&model, count);
+  QCOMPARE(model.rowCount(), count);
+
+  qint64 bytes { model.memoryUsage() };
+  qInfo("%d notes take %lld bytes", count, bytes);
+  QTest::setBenchmarkResult(static_cast<qreal>(bytes) / count, QTest::BytesAllocated);
+}
+
+QTEST_MAIN(Benchmark)
+#include "benchmark.moc"
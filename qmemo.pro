@@ -6,23 +6,47 @@ TEMPLATE = app
 TARGET = qmemo
 INCLUDEPATH += .
 
-QT += widgets core
+QT += widgets core concurrent
 
 CONFIG += debug_and_release
            
 # Input
-HEADERS += src/datahandler.hpp \
+HEADERS += src/archivestore.hpp \
+           src/datahandler.hpp \
+           src/directorystore.hpp \
+           src/editjournal.hpp \
+           src/fileindex.hpp \
            src/fileinfomodel.hpp \
            src/fileinfoproxy.hpp \
+           src/filescanner.hpp \
+           src/fileworker.hpp \
+           src/grepsearch.hpp \
+           src/notefile.hpp \
+           src/notehistory.hpp \
+           src/notestore.hpp \
+           src/packedstore.hpp \
+           src/searchindex.hpp \
            src/gui/editpane.hpp \
            src/gui/listpane.hpp \
            src/gui/mainwindow.hpp \
            src/gui/previewdelegate.hpp
 
 SOURCES += src/main.cpp \
+           src/archivestore.cpp \
            src/datahandler.cpp \
+           src/directorystore.cpp \
+           src/editjournal.cpp \
+           src/fileindex.cpp \
            src/fileinfomodel.cpp \
            src/fileinfoproxy.cpp \
+           src/filescanner.cpp \
+           src/fileworker.cpp \
+           src/grepsearch.cpp \
+           src/notefile.cpp \
+           src/notehistory.cpp \
+           src/notestore.cpp \
+           src/packedstore.cpp \
+           src/searchindex.cpp \
            src/gui/editpane.cpp \
            src/gui/listpane.cpp \
            src/gui/mainwindow.cpp \
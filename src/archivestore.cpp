@@ -0,0 +1,606 @@
+// qMemo/archivestore.cpp - archived notes kept in compressed packs
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "archivestore.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include "notefile.hpp"
+
+
+const quint32 ArchiveStore::MAGIC { 0x514d4150 }; // "QMAP"
+const quint32 ArchiveStore::VERSION { 1 };
+const int ArchiveStore::BATCH_SIZE { 64 };
+const QString ArchiveStore::UNPACKING_FILE { "unpacking" };
+
+// The choice lasts between sessions, as a pack directory without the
+// unpacking mark is packed.
+ArchiveStore::ArchiveStore(NoteStore* store, const QDir& archiveDirectory, const QDir& packDirectory, bool isPacking)
+  : NoteStore(), mStore(store), mArchiveDirectory(archiveDirectory), mPackDirectory(packDirectory),
+    mIsPacking(isPacking), mPackMutex(), mMutex(), mNotes(), mPacks(), mIsClosing(0), mPacking()
+{
+  loadPacks();
+  QFile mark { mPackDirectory.filePath(UNPACKING_FILE) };
+
+  if (mIsPacking) {
+    if (mark.exists()) mark.remove();
+
+    // notes archived before, or by other programs, are packed meanwhile
+    mPacking = QtConcurrent::run(this, &ArchiveStore::packLooseNotes);
+  } else {
+    if (!mark.exists() && !mark.open(QIODevice::WriteOnly)) {
+      qCritical("Failed to mark the packs: ArchiveStore::ArchiveStore()");
+    }
+
+    mPacking = QtConcurrent::run(this, &ArchiveStore::unpackNotes);
+  }
+}
+
+ArchiveStore::~ArchiveStore()
+{
+  mIsClosing.storeRelease(1);
+  mPacking.waitForFinished();
+}
+
+bool ArchiveStore::isPacking(const QDir& packDirectory)
+{
+  return packDirectory.exists() && !QFileInfo::exists(packDirectory.filePath(UNPACKING_FILE));
+}
+
+// Only the index at the head of a pack is read.
+void ArchiveStore::loadPacks()
+{
+  for (const auto& pack : mPackDirectory.entryList(QStringList("*.pack"), QDir::Files)) {
+    QFile file { mPackDirectory.filePath(pack) };
+
+    if (!file.open(QIODevice::ReadOnly)) continue;
+
+    QDataStream in { &file };
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    in >> magic >> version >> count;
+
+    if (in.status() != QDataStream::Ok || magic != MAGIC || version != VERSION) {
+      qCritical("Unknown pack: ArchiveStore::loadPacks()");
+      continue;
+    }
+
+    QHash<QString, PackedNote> notes;
+
+    for (quint32 i { 0 }; i < count; ++i) {
+      QString fileName;
+      PackedNote note;
+      note.pack = pack;
+      in >> fileName >> note.offset >> note.length >> note.size >> note.modified >> note.preview;
+      notes.insert(fileName, note);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+      qCritical("Broken pack: ArchiveStore::loadPacks()");
+      continue;
+    }
+
+    // offsets are counted from the end of the index
+    qint64 indexEnd { file.pos() };
+
+    for (auto i { notes.begin() }; i != notes.end(); ++i) {
+      i.value().offset += indexEnd;
+      mNotes.insert(i.key(), i.value());
+      mPacks[pack].insert(i.key());
+    }
+  }
+}
+
+// Notes are read and compressed without the lock, and packed only if
+// they have not changed meanwhile.
+void ArchiveStore::packLooseNotes()
+{
+  QHash<QString, QVector<IndexEntry>> months;
+
+  for (const auto& entry : mStore->list(mArchiveDirectory)) {
+    months[packOf(entry.modified)].append(entry);
+  }
+
+  for (auto i { months.constBegin() }; i != months.constEnd(); ++i) {
+    for (int first { 0 }; first < i.value().count(); first += BATCH_SIZE) {
+      if (mIsClosing.loadAcquire()) return;
+
+      QVector<Blob> blobs;
+
+      for (const auto& entry : i.value().mid(first, BATCH_SIZE)) {
+	blobs.append(blobOf(entry.fileName, mStore->read(mArchiveDirectory.filePath(entry.fileName)), entry.modified));
+      }
+
+      QMutexLocker locker { &mPackMutex };
+      QVector<Blob> unchanged;
+
+      // a note which was not read whole is left where it is
+      for (const auto& blob : blobs) {
+	QString path { mArchiveDirectory.filePath(blob.fileName) };
+
+	if (!mNotes.contains(blob.fileName) && mStore->modified(path) == blob.modified &&
+	    mStore->size(path) == blob.size) unchanged.append(blob);
+      }
+
+      if (unchanged.isEmpty()) continue;
+
+      if (!updatePack(i.key(), unchanged, QSet<QString>())) {
+	qCritical("Failed to pack notes: ArchiveStore::packLooseNotes()");
+	continue;
+      }
+
+      for (const auto& blob : unchanged) {
+	mStore->remove(mArchiveDirectory.filePath(blob.fileName));
+      }
+    }
+  }
+}
+
+// Packed notes are written back to the wrapped store a pack at a time,
+// unless it has a later version. The pack directory is removed at the
+// end, with its mark, when no other file is left in it.
+void ArchiveStore::unpackNotes()
+{
+  QStringList packs;
+
+  {
+    QMutexLocker locker { &mPackMutex };
+    packs = mPacks.keys();
+  }
+
+  for (const auto& pack : packs) {
+    if (mIsClosing.loadAcquire()) return;
+
+    QMutexLocker locker { &mPackMutex };
+    QSet<QString> written;
+
+    for (const auto& fileName : mPacks.value(pack)) {
+      PackedNote note { mNotes.value(fileName) };
+      QString path { mArchiveDirectory.filePath(fileName) };
+      QByteArray bytes { readNote(note) };
+
+      if (bytes.size() == note.size &&
+	  (mStore->modified(path) > note.modified || mStore->write(path, bytes, note.modified))) written.insert(fileName);
+    }
+
+    if (!written.isEmpty() && !updatePack(pack, QVector<Blob>(), written)) {
+      qCritical("Failed to write a pack: ArchiveStore::unpackNotes()");
+    }
+  }
+
+  QMutexLocker locker { &mPackMutex };
+
+  if (!mPacks.isEmpty() ||
+      mPackDirectory.entryList(QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot) != QStringList(UNPACKING_FILE)) return;
+
+  if (!QFile::remove(mPackDirectory.filePath(UNPACKING_FILE)) || !QDir().rmdir(mPackDirectory.absolutePath())) {
+    qCritical("Failed to remove the pack directory: ArchiveStore::unpackNotes()");
+  }
+}
+
+ArchiveStore::Blob ArchiveStore::blobOf(const QString& fileName, const QByteArray& bytes, qint64 modified)
+{
+  return Blob { fileName, bytes.size(), modified, NoteFile::previewOf(bytes.constData(), bytes.size()), qCompress(bytes) };
+}
+
+QString ArchiveStore::packOf(qint64 modified)
+{
+  return QDateTime::fromMSecsSinceEpoch(modified).toString("yyyy-MM") + ".pack";
+}
+
+// Called with the pack lock held, which keeps the notes from changing.
+// The pack is written again with the notes which it keeps, whose
+// compressed texts are copied as they are. Only the replacement of the
+// file and the new offsets are done under the lock of the readers.
+bool ArchiveStore::updatePack(const QString& pack, const QVector<Blob>& added, const QSet<QString>& removed)
+{
+  QString path { mPackDirectory.filePath(pack) };
+  QSet<QString> replaced { removed };
+  QVector<Blob> blobs;
+
+  for (const auto& blob : added) {
+    replaced.insert(blob.fileName);
+  }
+
+  if (!mPacks.value(pack).isEmpty()) {
+    QFile old { path };
+
+    if (!old.open(QIODevice::ReadOnly)) return false;
+
+    for (const auto& fileName : mPacks.value(pack)) {
+      if (replaced.contains(fileName)) continue;
+
+      PackedNote note { mNotes.value(fileName) };
+
+      if (!old.seek(note.offset)) return false;
+
+      Blob blob { fileName, note.size, note.modified, note.preview, old.read(note.length) };
+
+      if (blob.data.size() != note.length) return false;
+
+      blobs.append(blob);
+    }
+  }
+
+  blobs += added;
+  QSaveFile file { path };
+  qint64 indexEnd { 0 };
+
+  if (!blobs.isEmpty()) {
+    if (!file.open(QIODevice::WriteOnly)) return false;
+
+    QDataStream out { &file };
+    out.setVersion(QDataStream::Qt_5_0);
+    out << MAGIC << VERSION << static_cast<quint32>(blobs.count());
+    qint64 offset { 0 };
+
+    for (const auto& blob : blobs) {
+      out << blob.fileName << offset << static_cast<qint32>(blob.data.size()) << blob.size << blob.modified << blob.preview;
+      offset += blob.data.size();
+    }
+
+    // offsets are counted from here
+    indexEnd = file.pos();
+
+    for (const auto& blob : blobs) {
+      out.writeRawData(blob.data.constData(), blob.data.size());
+    }
+
+    if (out.status() != QDataStream::Ok) return false;
+  }
+
+  QMutexLocker locker { &mMutex };
+
+  if (blobs.isEmpty() ? QFile::exists(path) && !QFile::remove(path) : !file.commit()) return false;
+
+  for (const auto& fileName : mPacks.take(pack)) {
+    mNotes.remove(fileName);
+  }
+
+  qint64 offset { indexEnd };
+
+  for (const auto& blob : blobs) {
+    mNotes.insert(blob.fileName, PackedNote { pack, offset, blob.data.size(), blob.size, blob.modified, blob.preview });
+    mPacks[pack].insert(blob.fileName);
+    offset += blob.data.size();
+  }
+
+  return true;
+}
+
+// Called with either lock held.
+QByteArray ArchiveStore::readNote(const PackedNote& note) const
+{
+  QFile file { mPackDirectory.filePath(note.pack) };
+
+  if (!file.open(QIODevice::ReadOnly) || !file.seek(note.offset)) return QByteArray();
+
+  QByteArray data { file.read(note.length) };
+
+  return data.size() == note.length ? qUncompress(data) : QByteArray();
+}
+
+bool ArchiveStore::isArchived(const QString& path) const
+{
+  return QFileInfo(path).absolutePath() == mArchiveDirectory.absolutePath();
+}
+
+bool ArchiveStore::exists(const QString& path) const
+{
+  if (!isArchived(path)) return mStore->exists(path);
+
+  QMutexLocker locker { &mMutex };
+
+  return mNotes.contains(QFileInfo(path).fileName()) || mStore->exists(path);
+}
+
+bool ArchiveStore::hasNoteFiles() const
+{
+  return mStore->hasNoteFiles();
+}
+
+// The store is listed before the packs, so a note packed meanwhile is
+// found in one or the other.
+QVector<IndexEntry> ArchiveStore::list(const QDir& dir, const FileIndex* cache) const
+{
+  QVector<IndexEntry> entries { mStore->list(dir, cache) };
+
+  if (dir.absolutePath() != mArchiveDirectory.absolutePath()) return entries;
+
+  QMutexLocker locker { &mMutex };
+  QVector<IndexEntry> merged;
+  merged.reserve(mNotes.count() + entries.count());
+
+  for (auto i { mNotes.constBegin() }; i != mNotes.constEnd(); ++i) {
+    merged.append(IndexEntry { i.key(), i.value().size, i.value().modified, i.value().preview });
+  }
+
+  for (const auto& entry : entries) {
+    if (!mNotes.contains(entry.fileName)) merged.append(entry);
+  }
+
+  return merged;
+}
+
+QString ArchiveStore::load(const QString& path) const
+{
+  if (!isArchived(path)) return mStore->load(path);
+
+  QByteArray bytes { read(path) };
+
+  return NoteFile::decode(bytes.constData(), bytes.size());
+}
+
+QByteArray ArchiveStore::read(const QString& path) const
+{
+  if (isArchived(path)) {
+    QMutexLocker locker { &mMutex };
+    auto found { mNotes.constFind(QFileInfo(path).fileName()) };
+
+    if (found != mNotes.constEnd()) return readNote(found.value());
+  }
+
+  return mStore->read(path);
+}
+
+qint64 ArchiveStore::modified(const QString& path) const
+{
+  if (isArchived(path)) {
+    QMutexLocker locker { &mMutex };
+    auto found { mNotes.constFind(QFileInfo(path).fileName()) };
+
+    if (found != mNotes.constEnd()) return found.value().modified;
+  }
+
+  return mStore->modified(path);
+}
+
+QByteArray ArchiveStore::preview(const QString& path) const
+{
+  if (isArchived(path)) {
+    QMutexLocker locker { &mMutex };
+    auto found { mNotes.constFind(QFileInfo(path).fileName()) };
+
+    if (found != mNotes.constEnd()) return found.value().preview;
+  }
+
+  return mStore->preview(path);
+}
+
+// Called with the pack lock held. A note is packed by the month of its
+// last change, so a changed note may leave its pack.
+bool ArchiveStore::add(const QString& fileName, const QByteArray& bytes, qint64 modified)
+{
+  QString pack { packOf(modified) };
+  auto found { mNotes.constFind(fileName) };
+
+  if (found != mNotes.constEnd() && found.value().pack != pack &&
+      !updatePack(found.value().pack, QVector<Blob>(), { fileName })) return false;
+
+  return updatePack(pack, { blobOf(fileName, bytes, modified) }, QSet<QString>());
+}
+
+bool ArchiveStore::save(const QString& path, const QString& text, IndexEntry* entry)
+{
+  if (!isArchived(path)) return mStore->save(path, text, entry);
+
+  QByteArray bytes { text.toUtf8() };
+  qint64 modified { QDateTime::currentMSecsSinceEpoch() };
+
+  if (!write(path, bytes, modified)) return false;
+
+  if (entry) {
+    entry->fileName = QFileInfo(path).fileName();
+    entry->size = bytes.size();
+    entry->modified = modified;
+    entry->preview = NoteFile::previewOf(bytes.constData(), bytes.size());
+  }
+
+  return true;
+}
+
+bool ArchiveStore::write(const QString& path, const QByteArray& bytes, qint64 modified)
+{
+  if (!isArchived(path)) return mStore->write(path, bytes, modified);
+
+  QString fileName { QFileInfo(path).fileName() };
+  QMutexLocker locker { &mPackMutex };
+
+  if (!mIsPacking) {
+    auto found { mNotes.constFind(fileName) };
+
+    // a packed copy is outdated
+    return mStore->write(path, bytes, modified) &&
+      (found == mNotes.constEnd() || updatePack(found.value().pack, QVector<Blob>(), { fileName }));
+  }
+
+  if (!add(fileName, bytes, modified)) return false;
+
+  // a copy which was not packed yet is outdated
+  if (mStore->exists(path)) mStore->remove(path);
+
+  return true;
+}
+
+bool ArchiveStore::move(const QString& path, const QString& newPath)
+{
+  return moveAll({ path }, { newPath }).first();
+}
+
+// A note keeps the time of its last change on its way into the archive
+// and out of it. The notes are read and checked first, and every pack
+// which they enter or leave is then written once for the whole batch. A
+// note leaves its old place only once it is safe in the new one.
+QVector<bool> ArchiveStore::moveAll(const QStringList& paths, const QStringList& newPaths)
+{
+  QVector<bool> isDone(paths.count(), false);
+  QHash<QString, QVector<Blob>> added; // by pack
+  QHash<QString, QSet<QString>> removed; // by pack
+  QHash<int, QString> packs; // of the moved notes
+  QMutexLocker locker { &mPackMutex };
+
+  for (int i { 0 }; i < paths.count(); ++i) {
+    const QString& path { paths.at(i) };
+    const QString& newPath { newPaths.at(i) };
+    bool isToArchive { isArchived(newPath) };
+
+    if (isArchived(path) == isToArchive) {
+      if (isToArchive) {
+	qCritical("Notes are not renamed in the archive: ArchiveStore::moveAll()");
+      } else {
+	isDone[i] = mStore->move(path, newPath);
+      }
+
+      continue;
+    }
+
+    QString fileName { QFileInfo(path).fileName() };
+    QString newFileName { QFileInfo(newPath).fileName() };
+
+    if (isToArchive && !mIsPacking) {
+      if (!mNotes.contains(newFileName)) isDone[i] = mStore->move(path, newPath);
+
+      continue;
+    }
+
+    if (isToArchive) {
+      qint64 modified { mStore->modified(path) };
+
+      if (modified < 0 || mNotes.contains(newFileName) || mStore->exists(newPath)) continue;
+
+      QByteArray bytes { mStore->read(path) };
+
+      if (bytes.size() != mStore->size(path)) {
+	qCritical("Failed to read a note: ArchiveStore::moveAll()");
+	continue;
+      }
+
+      QString pack { packOf(modified) };
+      added[pack].append(blobOf(newFileName, bytes, modified));
+      packs.insert(i, pack);
+    } else {
+      auto found { mNotes.constFind(fileName) };
+
+      // not packed yet
+      if (found == mNotes.constEnd()) {
+	isDone[i] = mStore->move(path, newPath);
+	continue;
+      }
+
+      PackedNote note { found.value() };
+      QByteArray bytes { readNote(note) };
+
+      if (bytes.size() != note.size || mStore->exists(newPath) ||
+	  !mStore->write(newPath, bytes, note.modified)) continue;
+
+      removed[note.pack].insert(fileName);
+      packs.insert(i, note.pack);
+    }
+  }
+
+  QSet<QString> updated;
+
+  for (const auto& pack : QSet<QString>::fromList(added.keys() + removed.keys())) {
+    if (updatePack(pack, added.value(pack), removed.value(pack))) {
+      updated.insert(pack);
+    } else {
+      qCritical("Failed to write a pack: ArchiveStore::moveAll()");
+    }
+  }
+
+  QHash<QString, QSet<QString>> restored; // by pack
+
+  for (auto i { packs.constBegin() }; i != packs.constEnd(); ++i) {
+    const QString& path { paths.at(i.key()) };
+    const QString& newPath { newPaths.at(i.key()) };
+    bool isPackUpdated { updated.contains(i.value()) };
+
+    if (isArchived(newPath)) {
+      isDone[i.key()] = isPackUpdated && mStore->remove(path);
+
+      // the note is kept where it was
+      if (isPackUpdated && !isDone[i.key()]) restored[i.value()].insert(QFileInfo(newPath).fileName());
+    } else {
+      isDone[i.key()] = isPackUpdated;
+
+      // the copy is dropped, as the note is still packed
+      if (!isPackUpdated) mStore->remove(newPath);
+    }
+  }
+
+  for (auto i { restored.constBegin() }; i != restored.constEnd(); ++i) {
+    updatePack(i.key(), QVector<Blob>(), i.value());
+  }
+
+  return isDone;
+}
+
+bool ArchiveStore::remove(const QString& path)
+{
+  return removeAll({ path }).first();
+}
+
+// Every pack is written once for all of its notes in the batch.
+QVector<bool> ArchiveStore::removeAll(const QStringList& paths)
+{
+  QVector<bool> isDone(paths.count(), false);
+  QHash<QString, QSet<QString>> removed; // by pack
+  QHash<QString, QVector<int>> indexes; // by pack
+  QMutexLocker locker { &mPackMutex };
+
+  for (int i { 0 }; i < paths.count(); ++i) {
+    auto found { isArchived(paths.at(i)) ? mNotes.constFind(QFileInfo(paths.at(i)).fileName()) : mNotes.constEnd() };
+
+    if (found == mNotes.constEnd()) {
+      isDone[i] = mStore->remove(paths.at(i));
+    } else {
+      removed[found.value().pack].insert(found.key());
+      indexes[found.value().pack].append(i);
+    }
+  }
+
+  for (auto i { removed.constBegin() }; i != removed.constEnd(); ++i) {
+    bool isPackUpdated { updatePack(i.key(), QVector<Blob>(), i.value()) };
+
+    for (int index : indexes.value(i.key())) {
+      isDone[index] = isPackUpdated;
+    }
+  }
+
+  return isDone;
+}
+
+qint64 ArchiveStore::size(const QString& path) const
+{
+  if (isArchived(path)) {
+    QMutexLocker locker { &mMutex };
+    auto found { mNotes.constFind(QFileInfo(path).fileName()) };
+
+    if (found != mNotes.constEnd()) return found.value().size;
+  }
+
+  return mStore->size(path);
+}
@@ -0,0 +1,111 @@
+// qMemo/archivestore.hpp - archived notes kept in compressed packs
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QSet>
+#include "notestore.hpp"
+
+
+// Archived notes are grouped by the month of their last change into
+// packs, one compressed text per note behind an index of offsets and
+// previews. Listing the archive reads the index at the head of every
+// pack, and a note is decompressed only when it is loaded. Other notes
+// are left to the wrapped store, as are archived notes not packed yet.
+// A store which does not pack writes the packed notes back to the
+// wrapped store, and drops the pack directory once it is empty.
+// Packs are written under a lock of their own, so that the readers wait
+// only for the new file to replace the old one.
+class ArchiveStore : public NoteStore
+{
+public:
+  ArchiveStore(NoteStore* store, const QDir& archiveDirectory, const QDir& packDirectory, bool isPacking);
+  ~ArchiveStore() override;
+  ArchiveStore(const ArchiveStore& other) = delete;
+  ArchiveStore& operator=(const ArchiveStore& other) = delete;
+
+  bool exists(const QString& path) const override;
+  bool hasNoteFiles() const override;
+  QVector<IndexEntry> list(const QDir& dir, const FileIndex* cache = nullptr) const override;
+  QString load(const QString& path) const override;
+  qint64 modified(const QString& path) const override;
+  bool move(const QString& path, const QString& newPath) override;
+  QVector<bool> moveAll(const QStringList& paths, const QStringList& newPaths) override;
+  QByteArray preview(const QString& path) const override;
+  QByteArray read(const QString& path) const override;
+  bool remove(const QString& path) override;
+  QVector<bool> removeAll(const QStringList& paths) override;
+  bool save(const QString& path, const QString& text, IndexEntry* entry = nullptr) override;
+  qint64 size(const QString& path) const override;
+  bool write(const QString& path, const QByteArray& bytes, qint64 modified) override;
+
+  static bool isPacking(const QDir& packDirectory);
+
+private:
+  struct PackedNote
+  {
+    QString pack;
+    qint64 offset;
+    qint32 length; // compressed
+    qint64 size;
+    qint64 modified;
+    QByteArray preview;
+  };
+
+  struct Blob
+  {
+    QString fileName;
+    qint64 size;
+    qint64 modified;
+    QByteArray preview;
+    QByteArray data; // compressed
+  };
+
+  bool add(const QString& fileName, const QByteArray& bytes, qint64 modified);
+  bool isArchived(const QString& path) const;
+  void loadPacks();
+  void packLooseNotes();
+  QByteArray readNote(const PackedNote& note) const;
+  void unpackNotes();
+  bool updatePack(const QString& pack, const QVector<Blob>& added, const QSet<QString>& removed);
+
+  static Blob blobOf(const QString& fileName, const QByteArray& bytes, qint64 modified);
+  static QString packOf(qint64 modified);
+
+  QScopedPointer<NoteStore> mStore;
+  QDir mArchiveDirectory;
+  QDir mPackDirectory;
+  bool mIsPacking;
+  QMutex mPackMutex;
+  mutable QMutex mMutex;
+  QHash<QString, PackedNote> mNotes;
+  QHash<QString, QSet<QString>> mPacks;
+  QAtomicInt mIsClosing;
+  QFuture<void> mPacking;
+
+  static const quint32 MAGIC;
+  static const quint32 VERSION;
+  static const int BATCH_SIZE;
+  static const QString UNPACKING_FILE;
+};
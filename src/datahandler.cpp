@@ -19,26 +19,132 @@
 
 #include "datahandler.hpp"
 
+#include <QCoreApplication>
 #include <QDateTime>
 #include <QFileInfo>
 #include <QList>
-#include <QTextStream>
+#include <QtConcurrent>
+#include "archivestore.hpp"
+#include "filescanner.hpp"
+#include "fileworker.hpp"
+#include "notefile.hpp"
 
 
-const QString DataHandler::TIMESTAMP_PATTERN { "yyyy-MM-dd HH:mm:ss" };
 const QString DataHandler::DEFAULT_DIRECTORY { ".memo" };
 const QString DataHandler::ARCHIVE_DIRECTORY { "archive" };
-
-DataHandler::DataHandler()
-  : QObject(), mWorkDirectory(), mArchiveDirectory(),
+const QString DataHandler::DATA_DIRECTORY { ".qmemo" };
+const QString DataHandler::ACTIVE_INDEX { "active.index" };
+const QString DataHandler::ARCHIVE_INDEX { "archive.index" };
+const QString DataHandler::JOURNAL_DIRECTORY { "journal" };
+const QString DataHandler::PACK_DIRECTORY { "archive" };
+const QString DataHandler::HISTORY_DIRECTORY { "history" };
+const int DataHandler::SYNC_DELAY { 500 };
+const int DataHandler::ARCHIVE_RELEASE_DELAY { 5 * 60 * 1000 };
+const int DataHandler::NOTE_CACHE_SIZE { 16 << 20 }; // characters
+
+DataHandler::DataHandler(const QString& storeType, ArchivePacking archivePacking)
+  : QObject(), mWorkDirectory(), mArchiveDirectory(), mDataDirectory(), mStore(),
     mCurrentFile(),
-    mCurrentFileList(nullptr), mActiveFileList(), mArchiveFileList()
+    mCurrentFileList(nullptr), mActiveFileList(), mArchiveFileList(),
+    mActiveIndex(), mArchiveIndex(),
+    mActiveScanner(), mArchiveScanner(),
+    mWatcher(), mSyncTimer(), mReleaseTimer(), mIsArchiveLoaded(false), mChangedDirectories(), mSavedHashes(),
+    mPendingFiles(), mLoadingFile(), mNoteCache(NOTE_CACHE_SIZE), mFileThread(), mFileWorker(nullptr), mJournal(), mHistory(),
+    mSearchIndex(), mIsSearchEnabled(false), mPendingIndexUpdates(), mIndexWatcher(),
+    mIndexBatch(), mIndexBatchGeneration(0), mIndexGeneration(0),
+    mIndexBuildWatcher(), mIndexBuildMoves(),
+    mGrepSearch()
 {
   mWorkDirectory = setDirectory(QDir::home(), DEFAULT_DIRECTORY);
   mArchiveDirectory = setDirectory(mWorkDirectory, ARCHIVE_DIRECTORY);
-  setFileList(mWorkDirectory, &mActiveFileList);
-  setFileList(mArchiveDirectory, &mArchiveFileList);
+  mDataDirectory = setDirectory(mWorkDirectory, DATA_DIRECTORY);
+  mActiveIndex.setLocation(mWorkDirectory, mDataDirectory.filePath(ACTIVE_INDEX));
+  mArchiveIndex.setLocation(mArchiveDirectory, mDataDirectory.filePath(ARCHIVE_INDEX));
   mCurrentFileList = &mActiveFileList;
+  mStore.reset(NoteStore::create(storeType, { mWorkDirectory, mArchiveDirectory }, mDataDirectory));
+
+  if (!mStore) {
+    qWarning("Unknown store, the one in use is kept: DataHandler::DataHandler()");
+    mStore.reset(NoteStore::create(QString(), { mWorkDirectory, mArchiveDirectory }, mDataDirectory));
+  }
+
+  // packs which are no longer wanted are served until they are unpacked
+  QDir packDirectory { mDataDirectory.filePath(PACK_DIRECTORY) };
+  bool isPacking { archivePacking == StartPacking ||
+		   (archivePacking == KeepPacking && ArchiveStore::isPacking(packDirectory)) };
+
+  if (isPacking || packDirectory.exists()) {
+    mStore.reset(new ArchiveStore(mStore.take(), mArchiveDirectory, setDirectory(mDataDirectory, PACK_DIRECTORY), isPacking));
+  }
+
+  // edits which a crashed session did not save are written before the
+  // notes are listed
+  QDir journalDirectory { setDirectory(mDataDirectory, JOURNAL_DIRECTORY) };
+
+  for (const auto& path : EditJournal::recover(journalDirectory, mWorkDirectory, mStore.data())) {
+    qInfo("Recovered %s: DataHandler::DataHandler()", qPrintable(path));
+  }
+
+  mJournal.start(journalDirectory);
+  mHistory.setLocation(mWorkDirectory, setDirectory(mDataDirectory, HISTORY_DIRECTORY));
+
+  mActiveIndex.load();
+  scanDirectory(&mActiveFileList, false);
+
+  // the archive is listed when it is first shown, and dropped again once
+  // it has been hidden for a while
+  mReleaseTimer.setSingleShot(true);
+  mReleaseTimer.setInterval(ARCHIVE_RELEASE_DELAY);
+  connect(&mReleaseTimer, &QTimer::timeout, this, &DataHandler::releaseArchive);
+
+  // changes by other programs are applied after a burst of events settles
+  mSyncTimer.setSingleShot(true);
+  mSyncTimer.setInterval(SYNC_DELAY);
+  connect(&mSyncTimer, &QTimer::timeout, this, &DataHandler::syncChangedDirectories);
+
+  if (mStore->hasNoteFiles()) {
+    connect(&mWatcher, &QFileSystemWatcher::directoryChanged, this, &DataHandler::markDirectoryChanged);
+    connect(&mWatcher, &QFileSystemWatcher::fileChanged, this, &DataHandler::markFileChanged);
+    mWatcher.addPath(mWorkDirectory.absolutePath());
+    mWatcher.addPath(mArchiveDirectory.absolutePath());
+  }
+
+  connect(&mIndexWatcher, &QFutureWatcher<QVector<TokenizedNote>>::finished,
+	  this, &DataHandler::applyTokenizedNotes);
+  connect(&mIndexBuildWatcher, &QFutureWatcher<SearchIndex>::finished,
+	  this, &DataHandler::applyBuiltIndex);
+  connect(&mGrepSearch, &GrepSearch::filesFound, this, &DataHandler::filesMatched);
+
+  // notes are read and written on their own thread, so a slow disk never
+  // stalls the editor
+  mFileWorker = new FileWorker(mStore.data(), &mHistory, &mJournal);
+  mFileWorker->moveToThread(&mFileThread);
+  connect(&mFileThread, &QThread::finished, mFileWorker, &QObject::deleteLater);
+  connect(mFileWorker, &FileWorker::fileCreated, this, &DataHandler::applyCreatedFile);
+  connect(mFileWorker, &FileWorker::filesExported, this, &DataHandler::filesExported);
+  connect(mFileWorker, &FileWorker::fileLoaded, this, &DataHandler::applyLoadedFile);
+  connect(mFileWorker, &FileWorker::fileMoved, this, &DataHandler::applyMovedFile);
+  connect(mFileWorker, &FileWorker::fileRemoved, this, &DataHandler::applyRemovedFile);
+  connect(mFileWorker, &FileWorker::fileSaved, this, &DataHandler::applySavedFile);
+  connect(mFileWorker, &FileWorker::versionLoaded, this, &DataHandler::applyLoadedVersion);
+  connect(mFileWorker, &FileWorker::versionsLoaded, this, &DataHandler::applyLoadedVersions);
+  mFileThread.start();
+}
+
+DataHandler::~DataHandler()
+{
+  flush();
+  mFileThread.quit();
+  mFileThread.wait();
+  mJournal.discard();
+
+  // an unfinished scan leaves the index marked incomplete
+  mIndexWatcher.waitForFinished();
+  mIndexBuildWatcher.waitForFinished();
+  delete mActiveScanner;
+  delete mArchiveScanner;
+  mActiveIndex.save();
+  mArchiveIndex.save();
 }
 
 QDir DataHandler::setDirectory(QDir path, const QString& name)
@@ -56,16 +162,274 @@ QDir DataHandler::setDirectory(QDir path, const QString& name)
   return path;
 }
 
-void DataHandler::setFileList(const QDir& dir, FileInfoModel* list)
+void DataHandler::scanDirectory(FileInfoModel* list, bool isIncremental)
+{
+  FileIndex* index { indexOf(list) };
+  QPointer<FileScanner>& scanner { scannerOf(list) };
+  scanner = new FileScanner(mStore.data(), directoryOf(list), *index, isIncremental, this);
+
+  if (!isIncremental) {
+    index->clear();
+  }
+
+  connect(scanner, &FileScanner::entriesFound, this,
+	  [=](const QVector<IndexEntry>& entries) { mergeEntries(list, entries); });
+  connect(scanner, &FileScanner::entriesRemoved, this,
+	  [=](const QStringList& fileNames) { removeEntries(list, fileNames); });
+  connect(scanner, &FileScanner::finished, this,
+	  [=](qint64 directoryModified) {
+	    index->markComplete(directoryModified);
+	    index->save();
+	    scannerOf(list)->deleteLater();
+
+	    if (list->rowCount() > 0) {
+	      qInfo("Listed %d notes in %lld bytes each: DataHandler::scanDirectory()",
+		    list->rowCount(), static_cast<long long>(list->memoryUsage() / list->rowCount()));
+	    }
+	  });
+
+  scanner->start();
+}
+
+void DataHandler::mergeEntries(FileInfoModel* list, const QVector<IndexEntry>& entries)
 {
-  for (auto fileInfo : dir.entryInfoList(QDir::Files, QDir::Time)) {
+  QDir dir { directoryOf(list) };
+  FileIndex* index { indexOf(list) };
+  QVector<IndexEntry> added;
+
+  for (const auto& entry : entries) {
+    const IndexEntry* known { index->find(entry.fileName) };
+
+    if (!known) {
+      added.append(entry);
+    } else if (known->size == entry.size && known->modified == entry.modified) {
+      // we have written it ourselves since the scan started
+      continue;
+    } else {
+      list->modifyItem(QUrl::fromLocalFile(dir.filePath(entry.fileName)), entry.modified, entry.size, entry.preview);
+      mSavedHashes.remove(dir.filePath(entry.fileName));
+    }
+
+    index->insert(entry);
+    updateSearchIndex(dir.filePath(entry.fileName));
+  }
+
+  list->appendItems(dir, added);
+
+  if (!added.isEmpty() && list == mCurrentFileList) {
+    emit filesFound();
+  }
+}
+
+void DataHandler::removeEntries(FileInfoModel* list, const QStringList& fileNames)
+{
+  QDir dir { directoryOf(list) };
+  FileIndex* index { indexOf(list) };
+
+  for (const auto& fileName : fileNames) {
+    QFileInfo fileInfo { dir, fileName };
+
+    // it may have been created again since the scan started, or be
+    // still waiting to be written
+    if (!index->find(fileName) || mPendingFiles.contains(fileInfo.filePath()) || mStore->exists(fileInfo.filePath())) continue;
+
     QUrl url { QUrl::fromLocalFile(fileInfo.filePath()) };
-    QString modified { getLastModifiedDate(url) };
-    QString preview { getPreviewOfContents(url) };
-    list->appendItem(url, modified, preview);
+    index->remove(fileName);
+    removeFromSearchIndex(fileInfo.filePath());
+    mSavedHashes.remove(fileInfo.filePath());
+
+    if (url == currentFile()) {
+      releaseCurrentFile();
+    }
+
+    list->removeItem(url);
+  }
+}
+
+void DataHandler::markDirectoryChanged(const QString& path)
+{
+  mChangedDirectories.insert(path);
+
+  if (!mSyncTimer.isActive()) {
+    mSyncTimer.start();
   }
 }
 
+// A change of the open note alone leaves its directory as it was, so
+// the note is watched as well.
+void DataHandler::markFileChanged(const QString& path)
+{
+  watchCurrentFile();
+  markDirectoryChanged(QFileInfo(path).absolutePath());
+}
+
+// Every change is listed again, even our own, as the mtime of the
+// directory cannot tell them from those which other programs make at
+// the same time. The scan compares the mtime of every note, so a note
+// written in place is found as well.
+void DataHandler::syncChangedDirectories()
+{
+  for (auto list : { &mActiveFileList, &mArchiveFileList }) {
+    QString path { directoryOf(list).absolutePath() };
+
+    if (!mChangedDirectories.contains(path)) continue;
+
+    if (list == &mArchiveFileList && !mIsArchiveLoaded) {
+      // it is scanned when it is loaded
+      mChangedDirectories.remove(path);
+      continue;
+    }
+
+    if (scannerOf(list)) {
+      // wait for the running scan, as it works on an older snapshot
+      mSyncTimer.start();
+    } else {
+      mChangedDirectories.remove(path);
+      scanDirectory(list, true);
+    }
+  }
+}
+
+// The search index is built in the background on the first search, as
+// many sessions never search at all. Until it is built nothing matches,
+// and searchIndexChanged() asks for the search again.
+QSet<QString> DataHandler::search(const QString& query)
+{
+  if (!mIsSearchEnabled) {
+    mIsSearchEnabled = true;
+    mIndexBuildWatcher.setFuture(QtConcurrent::run(&SearchIndex::build, static_cast<const NoteStore*>(mStore.data()),
+						   QStringList { mWorkDirectory.absolutePath(), mArchiveDirectory.absolutePath() }));
+  }
+
+  return mSearchIndex.search(query);
+}
+
+// Matches stream in through filesMatched().
+void DataHandler::grep(const QString& pattern, bool isRegex)
+{
+  mGrepSearch.start(mStore.data(), { mWorkDirectory.absolutePath(), mArchiveDirectory.absolutePath() }, pattern, isRegex);
+}
+
+void DataHandler::cancelGrep()
+{
+  mGrepSearch.cancel();
+}
+
+// A null text means the note is read from its file.
+void DataHandler::updateSearchIndex(const QString& path, const QString& text)
+{
+  if (!mIsSearchEnabled) return;
+
+  mPendingIndexUpdates.insert(path, text);
+  indexPendingNotes();
+}
+
+// Notes are tokenized in the background, one batch at a time; updates
+// which arrive meanwhile wait for the next batch.
+void DataHandler::indexPendingNotes()
+{
+  if (mIndexWatcher.isRunning() || mIndexBuildWatcher.isRunning() || mPendingIndexUpdates.isEmpty()) return;
+
+  mIndexBatch.clear();
+  mIndexBatch.swap(mPendingIndexUpdates);
+  mIndexBatchGeneration = mIndexGeneration;
+  mIndexWatcher.setFuture(QtConcurrent::run(&SearchIndex::tokenizeNotes, static_cast<const NoteStore*>(mStore.data()),
+					    mIndexBatch));
+}
+
+// A batch which holds a note moved or removed since it started would
+// put the note back under its old path, so it is dropped, and the rest
+// of its notes are tokenized again with the next batch.
+void DataHandler::applyTokenizedNotes()
+{
+  if (mIndexBatchGeneration == mIndexGeneration) {
+    mSearchIndex.apply(mIndexWatcher.result());
+  } else {
+    for (auto it { mIndexBatch.constBegin() }; it != mIndexBatch.constEnd(); ++it) {
+      if (!mPendingIndexUpdates.contains(it.key())) mPendingIndexUpdates.insert(it.key(), it.value());
+    }
+  }
+
+  mIndexBatch.clear();
+  indexPendingNotes();
+  emit searchIndexChanged();
+}
+
+// The built index may predate the notes removed or moved during the
+// build, so those are done again on it.
+void DataHandler::applyBuiltIndex()
+{
+  mSearchIndex = mIndexBuildWatcher.result();
+
+  for (const auto& move : mIndexBuildMoves) {
+    renameInSearchIndex(move.first, move.second);
+  }
+
+  mIndexBuildMoves.clear();
+  indexPendingNotes();
+  emit searchIndexChanged();
+}
+
+void DataHandler::removeFromSearchIndex(const QString& path)
+{
+  renameInSearchIndex(path, QString());
+}
+
+// A null newPath removes the note. Updates of the note which wait, or
+// which a running batch holds, follow it to its new path.
+void DataHandler::renameInSearchIndex(const QString& path, const QString& newPath)
+{
+  if (mIndexBuildWatcher.isRunning()) {
+    mIndexBuildMoves.append(qMakePair(path, newPath));
+  } else if (newPath.isNull()) {
+    mSearchIndex.remove(path);
+  } else {
+    mSearchIndex.rename(path, newPath);
+  }
+
+  if (mIndexBatch.contains(path)) {
+    ++mIndexGeneration;
+    QString text { mIndexBatch.take(path) };
+
+    if (!newPath.isNull() && !mPendingIndexUpdates.contains(newPath)) mPendingIndexUpdates.insert(newPath, text);
+  }
+
+  if (mPendingIndexUpdates.contains(path)) {
+    QString text { mPendingIndexUpdates.take(path) };
+
+    if (!newPath.isNull()) mPendingIndexUpdates.insert(newPath, text);
+  }
+}
+
+QDir DataHandler::directoryOf(FileInfoModel* model) const
+{
+  return model == &mActiveFileList ? mWorkDirectory : mArchiveDirectory;
+}
+
+QPointer<FileScanner>& DataHandler::scannerOf(FileInfoModel* model)
+{
+  return model == &mActiveFileList ? mActiveScanner : mArchiveScanner;
+}
+
+FileIndex* DataHandler::indexOf(FileInfoModel* model)
+{
+  return model == &mActiveFileList ? &mActiveIndex : &mArchiveIndex;
+}
+
+FileInfoModel* DataHandler::listOf(const QString& path)
+{
+  return QFileInfo(path).absolutePath() == mWorkDirectory.absolutePath() ? &mActiveFileList : &mArchiveFileList;
+}
+
+// Lets the next sync find what a failed request has left behind.
+void DataHandler::repairList(FileInfoModel* list)
+{
+  if (list == &mArchiveFileList && !mIsArchiveLoaded) return;
+
+  indexOf(list)->invalidate();
+  markDirectoryChanged(directoryOf(list).absolutePath());
+}
+
 bool DataHandler::isAvailable() const
 {
   return !mWorkDirectory.absolutePath().isEmpty() && !mArchiveDirectory.absolutePath().isEmpty();
@@ -74,6 +438,54 @@ bool DataHandler::isAvailable() const
 void DataHandler::setActiveMode(bool b)
 {
   setCurrentFileList(b ? &mActiveFileList : &mArchiveFileList);
+
+  if (!b) {
+    mReleaseTimer.stop();
+    loadArchive();
+  } else if (mIsArchiveLoaded) {
+    mReleaseTimer.start();
+  }
+}
+
+// The list is shown at once from the index of the last session, which
+// the scan then brings up to date.
+void DataHandler::loadArchive()
+{
+  if (mIsArchiveLoaded) return;
+
+  mIsArchiveLoaded = true;
+  mArchiveIndex.load();
+  QVector<IndexEntry> entries { mArchiveIndex.entries() };
+  mArchiveFileList.appendItems(mArchiveDirectory, entries);
+  scanDirectory(&mArchiveFileList, true);
+
+  if (!entries.isEmpty() && mCurrentFileList == &mArchiveFileList) {
+    emit filesFound();
+  }
+}
+
+// Only the index file is kept, to load the list from next time.
+void DataHandler::releaseArchive()
+{
+  if (!mIsArchiveLoaded || mCurrentFileList == &mArchiveFileList) return;
+
+  // the scan and the notes on their way into the archive need the list
+  bool isBusy { mArchiveScanner || mChangedDirectories.contains(mArchiveDirectory.absolutePath()) };
+
+  for (const auto& path : mPendingFiles) {
+    if (listOf(path) == &mArchiveFileList) isBusy = true;
+  }
+
+  if (isBusy) {
+    mReleaseTimer.start();
+    return;
+  }
+
+  if (!mArchiveIndex.unload()) return;
+
+  mArchiveFileList.clear();
+  mIsArchiveLoaded = false;
+  qInfo("Released the archive list: DataHandler::releaseArchive()");
 }
 
 QUrl DataHandler::currentFile() const
@@ -83,7 +495,21 @@ QUrl DataHandler::currentFile() const
 
 void DataHandler::setCurrentFile(const QUrl& url)
 {
+  if (mWatcher.files().contains(mCurrentFile.toLocalFile())) mWatcher.removePath(mCurrentFile.toLocalFile());
+
   mCurrentFile = url;
+  watchCurrentFile();
+}
+
+// A replaced file is no longer watched, so the open note is watched
+// again after every change of it.
+void DataHandler::watchCurrentFile()
+{
+  QString path { currentFile().toLocalFile() };
+
+  if (mStore->hasNoteFiles() && !path.isEmpty() && !mWatcher.files().contains(path) && QFileInfo::exists(path)) {
+    mWatcher.addPath(path);
+  }
 }
 
 bool DataHandler::hasCurrentFile() const
@@ -103,11 +529,17 @@ void DataHandler::setCurrentFileList(FileInfoModel* model)
   emit isEditableChanged(mCurrentFileList == &mActiveFileList);
 }
 
+int DataHandler::fileCount() const
+{
+  return mCurrentFileList->rowCount();
+}
+
 bool DataHandler::isEditable() const
 {
   return mCurrentFileList == &mActiveFileList;
 }
 
+// The note is listed at once and written in the background.
 int DataHandler::createNewFile(const QString& text)
 {
   QUrl newFile { createFile() };
@@ -116,93 +548,171 @@ int DataHandler::createNewFile(const QString& text)
     qCritical("Failed to create new file: DataHandler::createNewFile()");
     return -1;
   } else {
-    if (!text.isEmpty()) {
-      saveFile(newFile, text);
+    QString path { newFile.toLocalFile() };
+    QByteArray bytes { text.toUtf8() };
+    IndexEntry entry {
+      newFile.fileName(),
+      bytes.size(),
+      QDateTime::currentMSecsSinceEpoch(),
+      NoteFile::previewOf(bytes.constData(), bytes.size())
+    };
+    indexOf(mCurrentFileList)->insert(entry);
+    mCurrentFileList->appendItem(newFile, entry.modified, entry.size, entry.preview);
+    mPendingFiles.insert(path);
+    mSavedHashes.insert(path, NoteFile::hash(text));
+    updateSearchIndex(path, text);
+
+    if (mJournal.isTracking(QString())) {
+      // the unsaved edits are in the new note now
+      mJournal.checkpoint(QString(), NoteFile::hash(QString()));
+      writeJournal();
     }
-    
-    mCurrentFileList->appendItem(newFile, getLastModifiedDate(newFile), getPreviewOfContents(newFile));
+
+    QMetaObject::invokeMethod(mFileWorker, "createFile", Qt::QueuedConnection,
+			      Q_ARG(QString, path), Q_ARG(QString, text));
     releaseCurrentFile();
     qInfo("Created a new file successfully: DataHandler::createNewFile()");
     return mCurrentFileList->rowCount() - 1;
   }
 }
 
-QString DataHandler::getLastModifiedDate(const QUrl& path) const
+// The name is checked against the list only, as the file is written later.
+QUrl DataHandler::createFile() const
 {
-  QFileInfo fileInfo { path.toLocalFile() };
+  if (mWorkDirectory.absolutePath().isEmpty()) {
+    qCritical("Cannot find \".memo\": DataHandler::createFile()");
+
+    return QUrl();
+  } else {
+    qint64 time { QDateTime::currentMSecsSinceEpoch() };
+    QUrl path;
+
+    do {
+      path = QUrl::fromLocalFile(mWorkDirectory.filePath(QString::number(time++) + ".txt"));
+    } while (mActiveFileList.rowOf(path) >= 0);
 
-  return fileInfo.lastModified().toString(TIMESTAMP_PATTERN);
+    return path;
+  }
 }
 
-QString DataHandler::getPreviewOfContents(const QUrl& path) const
+void DataHandler::applyCreatedFile(const QString& path, bool isDone, const IndexEntry& entry)
 {
-  static const int MAX_LENGTH_OF_PREVIEW { 300 };
-  QFile file { path.toLocalFile() };
-  QStringList lines;
+  FileInfoModel* list { listOf(path) };
+  mPendingFiles.remove(path);
+
+  if (!isDone) {
+    mSavedHashes.remove(path);
+    repairList(list);
+  } else if (list->rowOf(QUrl::fromLocalFile(path)) >= 0) {
+    updateFileInfo(list, entry);
+  }
+}
 
-  if (file.exists()) {
-    if (loadFile(&file, &lines, MAX_LENGTH_OF_PREVIEW, DataHandler::withTrim)) {
-      return lines.join(' ').left(MAX_LENGTH_OF_PREVIEW);
-    }
+// The text arrives through fileLoaded(), at once when it is in the
+// cache.
+void DataHandler::loadCurrentFile()
+{
+  if (!hasCurrentFile()) return;
+
+  QString path { currentFile().toLocalFile() };
+  const CachedNote* cached { cachedNote(path) };
+
+  if (cached) {
+    mLoadingFile.clear();
+    mSavedHashes.insert(path, cached->hash);
+    emit fileLoaded(cached->text);
+    return;
   }
 
-  return "";
+  mLoadingFile = path;
+  QMetaObject::invokeMethod(mFileWorker, "loadFile", Qt::QueuedConnection, Q_ARG(QString, mLoadingFile));
 }
 
-QUrl DataHandler::createFile() const
+// A cached text is used while the list shows the mtime it was read
+// with, so a note changed by another program is read again once the
+// list learns of it. A text whose save is queued is what the note will
+// hold.
+const DataHandler::CachedNote* DataHandler::cachedNote(const QString& path)
 {
-  QString name { QString::number(QDateTime::currentMSecsSinceEpoch()) + ".txt" };
+  const CachedNote* cached { mNoteCache.object(path) };
 
-  if (mWorkDirectory.absolutePath().isEmpty()) {
-    qCritical("Cannot find \".memo\": DataHandler::createFile()");
+  if (!cached || cached->modified < 0) return cached;
 
-    return QUrl();
-  } else {
-    QFileInfo fileInfo { mWorkDirectory, name };
-    QUrl path { QUrl::fromLocalFile(fileInfo.filePath()) };
-    QFile file { path.toLocalFile() };
+  FileInfoModel* list { listOf(path) };
+  int row { list->rowOf(QUrl::fromLocalFile(path)) };
 
-    return file.open(QIODevice::WriteOnly) ? path : QUrl();
-  }
+  return row >= 0 && list->modifiedTime(row) == cached->modified ? cached : nullptr;
 }
 
-QString DataHandler::loadCurrentFile() const
+// The notes next to the selected one are read in the background, so
+// moving to them finds them in the cache.
+void DataHandler::prefetchFiles(const QList<int>& indexes)
 {
-  static const int MAX_LENGTH_OF_TEXT { 0xffffff };
+  for (int index : indexes) {
+    if (index < 0 || index >= mCurrentFileList->rowCount()) continue;
+
+    QString path { mCurrentFileList->filePath(index) };
 
-  QFile file { currentFile().toLocalFile() };
-  QStringList contents;
-  loadFile(&file, &contents, MAX_LENGTH_OF_TEXT, withoutTrim);
-  return contents.join("");
+    if (mPendingFiles.contains(path) || path == mLoadingFile || cachedNote(path)) continue;
+
+    QMetaObject::invokeMethod(mFileWorker, "loadFile", Qt::QueuedConnection, Q_ARG(QString, path));
+  }
 }
 
-bool DataHandler::loadFile(QFile* file, QStringList* contents, int maxLength, QString (*func)(const QByteArray&)) const
+void DataHandler::applyLoadedFile(const QString& path, qint64 modified, const QString& text)
 {
-  if (!file->open(QIODevice::ReadOnly | QIODevice::Text)) {
-    qCritical("File wasn't loaded: DataHandler::loadFile()");
+  const CachedNote* cached { mNoteCache.object(path) };
 
-    return false;
+  // a queued save is newer than what was read
+  if (modified >= 0 && !(cached && cached->modified < 0)) {
+    mNoteCache.insert(path, new CachedNote { modified, NoteFile::hash(text), text }, text.size() + 1);
   }
 
-  while (!file->atEnd()) {
-    QString line { func(file->readLine(maxLength)) };
+  // another note may have been selected meanwhile, and a prefetched note
+  // is only kept
+  if (path != mLoadingFile || path != currentFile().toLocalFile()) return;
 
-    if (contents->length() + line.length() > maxLength) break;
+  mLoadingFile.clear();
+  mSavedHashes.insert(path, NoteFile::hash(text));
+  emit fileLoaded(text);
+}
 
-    contents->append(line);
+bool DataHandler::isLoading() const
+{
+  return hasCurrentFile() && mLoadingFile == currentFile().toLocalFile();
+}
+
+// The times of the saved versions of the current note, oldest first,
+// arrive through versionsLoaded().
+void DataHandler::requestVersions()
+{
+  if (!hasCurrentFile()) {
+    emit versionsLoaded(QVector<qint64>());
+    return;
   }
 
-  return true;
+  QMetaObject::invokeMethod(mFileWorker, "loadVersions", Qt::QueuedConnection,
+			    Q_ARG(QString, currentFile().toLocalFile()));
 }
 
-QString DataHandler::withoutTrim(const QByteArray& byteArray)
+// The text arrives through versionLoaded().
+void DataHandler::loadVersion(qint64 time)
 {
-  return byteArray;
+  if (!hasCurrentFile()) return;
+
+  QMetaObject::invokeMethod(mFileWorker, "loadVersion", Qt::QueuedConnection,
+			    Q_ARG(QString, currentFile().toLocalFile()), Q_ARG(qint64, time));
 }
 
-QString DataHandler::withTrim(const QByteArray& byteArray)
+// Versions of a note which is no longer open are dropped.
+void DataHandler::applyLoadedVersions(const QString& path, const QVector<qint64>& times)
 {
-  return QString::fromUtf8(byteArray).trimmed();
+  if (hasCurrentFile() && path == currentFile().toLocalFile()) emit versionsLoaded(times);
+}
+
+void DataHandler::applyLoadedVersion(const QString& path, const QString& text)
+{
+  if (hasCurrentFile() && path == currentFile().toLocalFile()) emit versionLoaded(text);
 }
 
 void DataHandler::selectFile(int index)
@@ -214,18 +724,27 @@ void DataHandler::selectFile(int index)
   }
 }
 
-bool DataHandler::saveCurrentFile(const QString& text) const
+// Saving is queued; a failure shows up in the log and in the list.
+bool DataHandler::saveCurrentFile(const QString& text)
 {
-  if (!hasCurrentFile()) {
+  if (!hasCurrentFile() || isLoading()) {
     qInfo("No file to save: DataHandler::saveCurrentFile()");
     return false;
-  } else if (saveFile(currentFile(), text)) {
-    updateFileInfo(currentFile());
-    qInfo("Saved successfully: DataHandler::saveCurrentFile()");
+  } else if (isSaved(currentFile(), text)) {
+    qInfo("No change to save: DataHandler::saveCurrentFile()");
     return true;
   } else {
-    qCritical("Failed to save: DataHandler::saveCurrentFile()");
-    return false;
+    QString path { currentFile().toLocalFile() };
+    QByteArray hash { NoteFile::hash(text) };
+    mSavedHashes.insert(path, hash);
+    mNoteCache.insert(path, new CachedNote { -1, hash, text }, text.size() + 1);
+    mJournal.checkpoint(path, hash);
+    writeJournal();
+    updateSearchIndex(path, text);
+    QMetaObject::invokeMethod(mFileWorker, "saveFile", Qt::QueuedConnection,
+			      Q_ARG(QString, path), Q_ARG(QString, text));
+    qInfo("Saved successfully: DataHandler::saveCurrentFile()");
+    return true;
   }
 }
 
@@ -236,32 +755,88 @@ bool DataHandler::saveAndCloseCurrentFile(const QString& text)
   return isSaved;
 }
 
-bool DataHandler::saveFile(const QUrl& path, const QString& lines) const
+// Text equal to what was last loaded or saved is not written again,
+// which keeps the mtime of the note and its place in the list.
+bool DataHandler::isSaved(const QUrl& path, const QString& lines) const
 {
-  QFile file { path.toLocalFile() };
+  auto found { mSavedHashes.constFind(path.toLocalFile()) };
 
-  if (!file.exists() ||
-      !file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+  return found != mSavedHashes.constEnd() &&
+    found.value() == NoteFile::hash(lines);
+}
 
-  QTextStream out { &file };
-  out << lines;
+void DataHandler::applySavedFile(const QString& path, bool isDone, const IndexEntry& entry, const QByteArray& hash)
+{
+  FileInfoModel* list { listOf(path) };
+
+  CachedNote* cached { mNoteCache.object(path) };
+
+  if (!isDone) {
+    // the next save writes the text again
+    mSavedHashes.remove(path);
+    mNoteCache.remove(path);
+  } else {
+    mJournal.compact(path, hash);
+    writeJournal();
+
+    // a later save of the note may still be queued
+    if (cached && cached->hash == hash) cached->modified = entry.modified;
+
+    if (list->rowOf(QUrl::fromLocalFile(path)) >= 0) {
+      updateFileInfo(list, entry);
+    }
+
+    // a new note has a file only now
+    if (hasCurrentFile() && path == currentFile().toLocalFile()) watchCurrentFile();
+  }
+}
+
+// Edits of a note without a file are journaled under an empty path.
+void DataHandler::recordEdit(int position, int charsRemoved, const QString& inserted)
+{
+  if (!isEditable() || isLoading()) return;
 
-  return true;
+  QString path { currentFile().toLocalFile() };
+
+  if (!mJournal.isTracking(path)) {
+    mJournal.checkpoint(path, path.isEmpty() ? NoteFile::hash(QString()) : mSavedHashes.value(path));
+  }
+
+  mJournal.recordEdit(position, charsRemoved, inserted);
+  writeJournal();
+}
+
+// Edits which arrive before the worker gets to them are written together.
+void DataHandler::writeJournal()
+{
+  if (mJournal.queueFlush()) {
+    QMetaObject::invokeMethod(mFileWorker, "writeJournal", Qt::QueuedConnection);
+  }
+}
+
+// Waits until every queued request has reached the disk, and applies
+// the results.
+void DataHandler::flush()
+{
+  QMetaObject::invokeMethod(mFileWorker, "flush", Qt::BlockingQueuedConnection);
+  QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
 }
 
 int DataHandler::deleteEmptyFile()
 {
-  if (hasCurrentFile()) {
+  if (hasCurrentFile() && !isLoading()) {
     QUrl dispose { currentFile() };
+    QString path { dispose.toLocalFile() };
+    qInfo("Delete empty file: DataHandler::deleteEmptyFile()");
+    indexOf(mCurrentFileList)->remove(dispose.fileName());
+    mSavedHashes.remove(path);
+    removeFromSearchIndex(path);
+    QMetaObject::invokeMethod(mFileWorker, "removeFiles", Qt::QueuedConnection, Q_ARG(QStringList, QStringList(path)));
+    releaseCurrentFile();
+    QModelIndex sourceIndex { mCurrentFileList->removeItem(dispose) };
 
-    if (deleteFile(currentFile())) {
-      qInfo("Delete empty file: DataHandler::deleteEmptyFile()");
-      releaseCurrentFile();
-      QModelIndex sourceIndex { mCurrentFileList->removeItem(dispose) };
-
-      if (sourceIndex.isValid()) {
-	return sourceIndex.row();
-      }
+    if (sourceIndex.isValid()) {
+      return sourceIndex.row();
     }
   }
 
@@ -269,43 +844,143 @@ int DataHandler::deleteEmptyFile()
   return -1;
 }
 
-bool DataHandler::deleteFile(const QUrl& path) const
+void DataHandler::applyRemovedFile(const QString& path, bool isDone)
 {
-  QFile file { path.toLocalFile() };
+  FileInfoModel* list { listOf(path) };
+  mNoteCache.remove(path);
 
-  return file.exists() && file.remove();
+  if (!isDone) repairList(list);
 }
 
-void DataHandler::updateFileInfo(const QUrl& url) const
+void DataHandler::updateFileInfo(FileInfoModel* list, const IndexEntry& entry)
 {
-  mCurrentFileList->modifyItem(url, getLastModifiedDate(url), getPreviewOfContents(url));
+  indexOf(list)->insert(entry);
+  list->modifyItem(QUrl::fromLocalFile(directoryOf(list).filePath(entry.fileName)), entry.modified, entry.size, entry.preview);
 }
 
 void DataHandler::moveCurrentFile(int index)
 {
   QModelIndex proxyIndex { mCurrentFileList->index(index, 0) };
   QUrl url { mCurrentFileList->get(proxyIndex, "fileURL").toUrl() };
-  FileInfoModel* otherFileList { mCurrentFileList == &mActiveFileList ? &mArchiveFileList : &mActiveFileList };
-		
+
   if (url == currentFile()) {
-    QUrl newUrl { moveCurrentFile(url) };
-    otherFileList->appendItem(newUrl, getLastModifiedDate(newUrl), getPreviewOfContents(newUrl));
-    releaseCurrentFile();
-    mCurrentFileList->removeItem(url); // invoke onCurrentIndexChanged()
-    qInfo("Moved successfully: DataHandler::moveCurrentFile()");
+    moveFiles({ url });
   } else {
     qCritical("Failed to move: DataHandler::moveCurrentFile()");
   }
 }
 
-QUrl DataHandler::moveCurrentFile(const QUrl& url) const
+// Renaming keeps the mtime, so the notes move with the size, mtime and
+// preview already known. They join the other list in one insertion and
+// leave this one in one removal, and FileWorker renames the files.
+void DataHandler::moveFiles(const QList<QUrl>& files)
+{
+  FileInfoModel* otherFileList { mCurrentFileList == &mActiveFileList ? &mArchiveFileList : &mActiveFileList };
+
+  if (otherFileList == &mArchiveFileList && !mIsArchiveLoaded) {
+    loadArchive();
+    mReleaseTimer.start();
+  }
+
+  QVector<IndexEntry> entries;
+  QList<QUrl> moved;
+  QStringList paths;
+  QStringList newPaths;
+
+  for (const auto& url : files) {
+    int row { mCurrentFileList->rowOf(url) };
+
+    // a note still being created or moved is left alone
+    if (row < 0 || mPendingFiles.contains(url.toLocalFile())) continue;
+
+    QUrl newUrl { movedFile(url) };
+    IndexEntry entry {
+      newUrl.fileName(),
+      mCurrentFileList->size(row),
+      mCurrentFileList->modifiedTime(row),
+      mCurrentFileList->previewBytes(row)
+    };
+    indexOf(mCurrentFileList)->remove(url.fileName());
+    indexOf(otherFileList)->insert(entry);
+    entries.append(entry);
+    mPendingFiles.insert(newUrl.toLocalFile());
+    renameInSearchIndex(url.toLocalFile(), newUrl.toLocalFile());
+    mSavedHashes.remove(url.toLocalFile());
+    moved.append(url);
+    paths.append(url.toLocalFile());
+    newPaths.append(newUrl.toLocalFile());
+
+    if (url == currentFile()) releaseCurrentFile(); // release before the removal
+  }
+
+  if (moved.isEmpty()) {
+    qCritical("Failed to move: DataHandler::moveFiles()");
+    return;
+  }
+
+  otherFileList->appendItems(directoryOf(otherFileList), entries);
+  QMetaObject::invokeMethod(mFileWorker, "moveFiles", Qt::QueuedConnection,
+			    Q_ARG(QStringList, paths), Q_ARG(QStringList, newPaths));
+  mCurrentFileList->removeItems(moved); // invoke onCurrentIndexChanged()
+  qInfo("Moved %d notes successfully: DataHandler::moveFiles()", moved.count());
+}
+
+void DataHandler::removeFiles(const QList<QUrl>& files)
+{
+  QList<QUrl> removed;
+  QStringList paths;
+
+  for (const auto& url : files) {
+    QString path { url.toLocalFile() };
+
+    if (mCurrentFileList->rowOf(url) < 0 || mPendingFiles.contains(path)) continue;
+
+    indexOf(mCurrentFileList)->remove(url.fileName());
+    mSavedHashes.remove(path);
+    removeFromSearchIndex(path);
+    removed.append(url);
+    paths.append(path);
+
+    if (url == currentFile()) releaseCurrentFile(); // release before the removal
+  }
+
+  if (removed.isEmpty()) return;
+
+  QMetaObject::invokeMethod(mFileWorker, "removeFiles", Qt::QueuedConnection, Q_ARG(QStringList, paths));
+  mCurrentFileList->removeItems(removed);
+  qInfo("Deleted %d notes: DataHandler::removeFiles()", removed.count());
+}
+
+// The outcome arrives through filesExported().
+void DataHandler::exportFiles(const QList<QUrl>& files, const QString& directory)
+{
+  QStringList paths;
+
+  for (const auto& url : files) {
+    paths.append(url.toLocalFile());
+  }
+
+  QMetaObject::invokeMethod(mFileWorker, "exportFiles", Qt::QueuedConnection,
+			    Q_ARG(QStringList, paths), Q_ARG(QString, directory));
+}
+
+QUrl DataHandler::movedFile(const QUrl& url) const
 {
   QFileInfo file { url.toLocalFile() };
   QDir dir { (file.path() == mWorkDirectory.path()) ? mArchiveDirectory : mWorkDirectory };
-
   QFileInfo newPath { dir, file.fileName() };
-  QFile oldPath { file.filePath() };
-  oldPath.rename(newPath.filePath());
 
   return QUrl::fromLocalFile(newPath.filePath());
 }
+
+void DataHandler::applyMovedFile(const QString& path, const QString& newPath, bool isDone)
+{
+  mPendingFiles.remove(newPath);
+  mNoteCache.remove(path);
+
+  if (isDone) return;
+
+  for (auto list : { listOf(path), listOf(newPath) }) {
+    repairList(list);
+  }
+}
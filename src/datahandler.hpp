@@ -20,10 +20,28 @@
 #pragma once
 
 
+#include <QCache>
 #include <QDir>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QHash>
 #include <QObject>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
 #include <QUrl>
+#include "editjournal.hpp"
+#include "fileindex.hpp"
 #include "fileinfomodel.hpp"
+#include "grepsearch.hpp"
+#include "notehistory.hpp"
+#include "notestore.hpp"
+#include "searchindex.hpp"
+
+class FileScanner;
+class FileWorker;
 
 
 class DataHandler : public QObject
@@ -31,57 +49,146 @@ class DataHandler : public QObject
   Q_OBJECT
 
 public:
-  DataHandler();
-  ~DataHandler() = default;
+  // archived notes are packed as in the last session unless told
+  enum ArchivePacking { KeepPacking, StartPacking, StopPacking };
+
+  DataHandler(const QString& storeType, ArchivePacking archivePacking);
+  ~DataHandler();
   DataHandler(const DataHandler& other) = delete;
   DataHandler& operator=(const DataHandler& other) = delete;
   DataHandler(const DataHandler&& other) = delete;
   DataHandler& operator=(const DataHandler&& other) = delete;
 
+  void cancelGrep();
   int createNewFile(const QString& text);
   int deleteEmptyFile();
+  void exportFiles(const QList<QUrl>& files, const QString& directory);
+  int fileCount() const;
+  void flush();
   bool hasCurrentFile() const;
+  void grep(const QString& pattern, bool isRegex);
   bool isAvailable() const;
   bool isEditable() const;
-  QString loadCurrentFile() const;
+  bool isLoading() const;
+  void loadVersion(qint64 time);
+  void loadCurrentFile();
   void moveCurrentFile(int index);
+  void moveFiles(const QList<QUrl>& files);
+  void prefetchFiles(const QList<int>& indexes);
+  void recordEdit(int position, int charsRemoved, const QString& inserted);
   void releaseCurrentFile();
+  void removeFiles(const QList<QUrl>& files);
+  void requestVersions();
   bool saveAndCloseCurrentFile(const QString& text);
-  bool saveCurrentFile(const QString& text) const;
+  bool saveCurrentFile(const QString& text);
+  QSet<QString> search(const QString& query);
   void selectFile(int index);
   void setActiveMode(bool b);
 
 signals:
   void fileListSwitched(FileInfoModel* fileList);
+  void filesExported(int exported, int failed);
+  void fileLoaded(const QString& text);
+  void filesFound();
+  void filesMatched(const QSet<QString>& paths);
   void isEditableChanged(bool b);
+  void searchIndexChanged();
+  void versionLoaded(const QString& text);
+  void versionsLoaded(const QVector<qint64>& times);
 
 private:
+  // the text of a note as it was loaded or saved
+  struct CachedNote
+  {
+    qint64 modified; // negative while its save is queued
+    QByteArray hash;
+    QString text;
+  };
+
+  void applyBuiltIndex();
+  void applyCreatedFile(const QString& path, bool isDone, const IndexEntry& entry);
+  void applyLoadedFile(const QString& path, qint64 modified, const QString& text);
+  void applyLoadedVersion(const QString& path, const QString& text);
+  void applyLoadedVersions(const QString& path, const QVector<qint64>& times);
+  void applyMovedFile(const QString& path, const QString& newPath, bool isDone);
+  void applyRemovedFile(const QString& path, bool isDone);
+  void applySavedFile(const QString& path, bool isDone, const IndexEntry& entry, const QByteArray& hash);
+  const CachedNote* cachedNote(const QString& path);
   QUrl createFile() const;
   QUrl currentFile() const;
-  bool deleteFile(const QUrl& path) const;
-  QString getLastModifiedDate(const QUrl& path) const;
-  QString getPreviewOfContents(const QUrl& path) const;
-  bool loadFile(QFile* file, QStringList* contents, int maxLength, QString(*func)(const QByteArray&)) const;
-  QUrl moveCurrentFile(const QUrl& url) const;
-  bool saveFile(const QUrl& path, const QString& lines) const;
+  QDir directoryOf(FileInfoModel* model) const;
+  FileIndex* indexOf(FileInfoModel* model);
+  bool isSaved(const QUrl& path, const QString& lines) const;
+  void applyTokenizedNotes();
+  void indexPendingNotes();
+  FileInfoModel* listOf(const QString& path);
+  void loadArchive();
+  void markDirectoryChanged(const QString& path);
+  void markFileChanged(const QString& path);
+  void mergeEntries(FileInfoModel* list, const QVector<IndexEntry>& entries);
+  QUrl movedFile(const QUrl& url) const;
+  void releaseArchive();
+  void repairList(FileInfoModel* list);
+  void removeEntries(FileInfoModel* list, const QStringList& fileNames);
+  void removeFromSearchIndex(const QString& path);
+  void renameInSearchIndex(const QString& path, const QString& newPath);
+  void scanDirectory(FileInfoModel* list, bool isIncremental);
+  QPointer<FileScanner>& scannerOf(FileInfoModel* model);
   void setCurrentFile(const QUrl& url);
   void setCurrentFileList(FileInfoModel* model);
   QDir setDirectory(QDir path, const QString& name);
-  void setFileList(const QDir& dir, FileInfoModel* list);
   void setIsEditable(bool b);
-  void updateFileInfo(const QUrl& url) const;
-
-  static QString withTrim(const QByteArray& byteArray);
-  static QString withoutTrim(const QByteArray& byteArray);
+  void syncChangedDirectories();
+  void updateFileInfo(FileInfoModel* list, const IndexEntry& entry);
+  void updateSearchIndex(const QString& path, const QString& text = QString());
+  void watchCurrentFile();
+  void writeJournal();
 
   QDir mWorkDirectory;
   QDir mArchiveDirectory;
+  QDir mDataDirectory;
+  QScopedPointer<NoteStore> mStore;
   QUrl mCurrentFile;
   FileInfoModel* mCurrentFileList;
   FileInfoModel mActiveFileList;
   FileInfoModel mArchiveFileList;
+  FileIndex mActiveIndex;
+  FileIndex mArchiveIndex;
+  QPointer<FileScanner> mActiveScanner;
+  QPointer<FileScanner> mArchiveScanner;
+  QFileSystemWatcher mWatcher;
+  QTimer mSyncTimer;
+  QTimer mReleaseTimer;
+  bool mIsArchiveLoaded;
+  QSet<QString> mChangedDirectories;
+  QHash<QString, QByteArray> mSavedHashes;
+  QSet<QString> mPendingFiles;
+  QString mLoadingFile;
+  QCache<QString, CachedNote> mNoteCache;
+  QThread mFileThread;
+  FileWorker* mFileWorker;
+  EditJournal mJournal;
+  NoteHistory mHistory;
+  SearchIndex mSearchIndex;
+  bool mIsSearchEnabled;
+  QHash<QString, QString> mPendingIndexUpdates;
+  QFutureWatcher<QVector<TokenizedNote>> mIndexWatcher;
+  QHash<QString, QString> mIndexBatch; // the notes mIndexWatcher tokenizes, until applied
+  int mIndexBatchGeneration;
+  int mIndexGeneration; // counts the notes of a batch moved or removed
+  QFutureWatcher<SearchIndex> mIndexBuildWatcher;
+  QVector<QPair<QString, QString>> mIndexBuildMoves;
+  GrepSearch mGrepSearch;
 
-  static const QString TIMESTAMP_PATTERN;
   static const QString DEFAULT_DIRECTORY;
   static const QString ARCHIVE_DIRECTORY;
+  static const QString DATA_DIRECTORY;
+  static const QString ACTIVE_INDEX;
+  static const QString ARCHIVE_INDEX;
+  static const QString JOURNAL_DIRECTORY;
+  static const QString PACK_DIRECTORY;
+  static const QString HISTORY_DIRECTORY;
+  static const int SYNC_DELAY;
+  static const int ARCHIVE_RELEASE_DELAY;
+  static const int NOTE_CACHE_SIZE;
 };
@@ -0,0 +1,131 @@
+// qMemo/directorystore.cpp - notes kept as one file each
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "directorystore.hpp"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include "notefile.hpp"
+
+
+bool DirectoryStore::exists(const QString& path) const
+{
+  return QFileInfo::exists(path);
+}
+
+bool DirectoryStore::hasNoteFiles() const
+{
+  return true;
+}
+
+// The entries have no previews, which are read for the changed ones only.
+QVector<IndexEntry> DirectoryStore::list(const QDir& dir, const FileIndex* cache) const
+{
+  QFileInfoList fileInfoList;
+
+  if (cache && cache->isDirectoryUnchanged()) {
+    // no file was added or removed, so stat only the indexed ones
+    for (const auto& entry : cache->entries()) {
+      QFileInfo fileInfo { dir, entry.fileName };
+
+      if (fileInfo.exists()) fileInfoList.append(fileInfo);
+    }
+  } else {
+    fileInfoList = dir.entryInfoList(QDir::Files);
+  }
+
+  QVector<IndexEntry> entries;
+  entries.reserve(fileInfoList.count());
+
+  for (const auto& fileInfo : fileInfoList) {
+    entries.append(IndexEntry {
+	fileInfo.fileName(),
+	fileInfo.size(),
+	fileInfo.lastModified().toMSecsSinceEpoch(),
+	QByteArray()
+      });
+  }
+
+  return entries;
+}
+
+QString DirectoryStore::load(const QString& path) const
+{
+  return NoteFile::load(path);
+}
+
+qint64 DirectoryStore::modified(const QString& path) const
+{
+  QFileInfo fileInfo { path };
+
+  return fileInfo.exists() ? fileInfo.lastModified().toMSecsSinceEpoch() : -1;
+}
+
+bool DirectoryStore::move(const QString& path, const QString& newPath)
+{
+  return QFile::rename(path, newPath);
+}
+
+QByteArray DirectoryStore::preview(const QString& path) const
+{
+  return NoteFile::preview(path);
+}
+
+QByteArray DirectoryStore::read(const QString& path) const
+{
+  QFile file { path };
+
+  return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+bool DirectoryStore::remove(const QString& path)
+{
+  QFile file { path };
+
+  return file.exists() && file.remove();
+}
+
+bool DirectoryStore::save(const QString& path, const QString& text, IndexEntry* entry)
+{
+  return NoteFile::save(path, text, entry);
+}
+
+qint64 DirectoryStore::size(const QString& path) const
+{
+  QFileInfo fileInfo { path };
+
+  return fileInfo.exists() ? fileInfo.size() : -1;
+}
+
+// The note keeps the given time, as a moved file would.
+bool DirectoryStore::write(const QString& path, const QByteArray& bytes, qint64 modified)
+{
+  QSaveFile saveFile { path };
+
+  if (!saveFile.open(QIODevice::WriteOnly) ||
+      saveFile.write(bytes) != bytes.size() ||
+      !saveFile.commit()) return false;
+
+  QFile file { path };
+
+  return file.open(QIODevice::Append) &&
+    file.setFileTime(QDateTime::fromMSecsSinceEpoch(modified), QFileDevice::FileModificationTime);
+}
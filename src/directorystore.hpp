@@ -0,0 +1,42 @@
+// qMemo/directorystore.hpp - notes kept as one file each
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "notestore.hpp"
+
+
+// Every note is a text file of its own, which other programs can read
+// and edit.
+class DirectoryStore : public NoteStore
+{
+public:
+  bool exists(const QString& path) const override;
+  bool hasNoteFiles() const override;
+  QVector<IndexEntry> list(const QDir& dir, const FileIndex* cache = nullptr) const override;
+  QString load(const QString& path) const override;
+  qint64 modified(const QString& path) const override;
+  bool move(const QString& path, const QString& newPath) override;
+  QByteArray preview(const QString& path) const override;
+  QByteArray read(const QString& path) const override;
+  bool remove(const QString& path) override;
+  bool save(const QString& path, const QString& text, IndexEntry* entry = nullptr) override;
+  qint64 size(const QString& path) const override;
+  bool write(const QString& path, const QByteArray& bytes, qint64 modified) override;
+};
@@ -0,0 +1,295 @@
+// qMemo/editjournal.cpp - write-ahead journal of the edits to notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "editjournal.hpp"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QVector>
+#include "notefile.hpp"
+#include "notestore.hpp"
+
+
+const QString EditJournal::SUFFIX { ".journal" };
+const qint64 EditJournal::COMPACT_SIZE { 1 << 20 };
+
+EditJournal::EditJournal()
+  : mFile(), mLock(), mPath(), mHash(), mHasBase(false), mUnsaved(), mSize(0),
+    mMutex(), mBuffer(), mIsRestarting(false), mIsFlushQueued(false)
+{
+}
+
+EditJournal::~EditJournal()
+{
+  mFile.close();
+}
+
+bool EditJournal::start(const QDir& dir)
+{
+  QString name { QString("%1-%2%3")
+      .arg(QDateTime::currentMSecsSinceEpoch())
+      .arg(QCoreApplication::applicationPid())
+      .arg(SUFFIX) };
+  mLock.reset(new QLockFile(dir.filePath(name + ".lock")));
+  mFile.setFileName(dir.filePath(name));
+
+  // written straight through, so the edits survive a crash of qMemo
+  if (!mLock->tryLock(0) || !mFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+    qCritical("Failed to start journal: EditJournal::start()");
+    return false;
+  }
+
+  return true;
+}
+
+// Removes the journal when all edits have been saved.
+void EditJournal::discard()
+{
+  if (mFile.isOpen()) {
+    mFile.close();
+    mFile.remove();
+  }
+
+  mLock.reset();
+}
+
+bool EditJournal::isTracking(const QString& path) const
+{
+  return mHasBase && mPath == path;
+}
+
+// Records that the following edits apply to the given text of a note,
+// which is being saved. The records of the note are needed until the
+// save is done.
+void EditJournal::checkpoint(const QString& path, const QByteArray& hash)
+{
+  // the edits of a note without a file have gone into a new note
+  if (path.isEmpty()) {
+    mUnsaved.remove(path);
+  } else {
+    mUnsaved.insert(path, hash);
+  }
+
+  writeBase(path, hash);
+}
+
+void EditJournal::writeBase(const QString& path, const QByteArray& hash)
+{
+  mPath = path;
+  mHash = hash;
+  mHasBase = true;
+
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(BaseRecord) << path << hash;
+  write(record);
+}
+
+void EditJournal::recordEdit(int position, int charsRemoved, const QString& inserted)
+{
+  // no saved text matches an empty hash
+  mUnsaved.insert(mPath, QByteArray());
+
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(EditRecord) << static_cast<qint32>(position)
+      << static_cast<qint32>(charsRemoved) << inserted;
+  write(record);
+}
+
+// Called when a note has been written. Once no note has records which
+// are still needed, the journal starts over from the note being edited.
+void EditJournal::compact(const QString& path, const QByteArray& hash)
+{
+  auto found { mUnsaved.find(path) };
+
+  if (found != mUnsaved.end() && found.value() == hash) mUnsaved.erase(found);
+
+  if (!mFile.isOpen() || mSize < COMPACT_SIZE || !mUnsaved.isEmpty()) return;
+
+  {
+    QMutexLocker locker { &mMutex };
+    mBuffer.clear();
+    mIsRestarting = true;
+  }
+
+  mSize = 0;
+
+  if (mHasBase) writeBase(mPath, mHash);
+}
+
+// The records are written by the next flush().
+void EditJournal::write(const QByteArray& record)
+{
+  QMutexLocker locker { &mMutex };
+  mBuffer += record;
+  mSize += record.size();
+}
+
+// Returns true if a flush() has to be queued for the buffered records.
+bool EditJournal::queueFlush()
+{
+  QMutexLocker locker { &mMutex };
+
+  if (mIsFlushQueued || (mBuffer.isEmpty() && !mIsRestarting)) return false;
+
+  mIsFlushQueued = true;
+  return true;
+}
+
+// Writes the buffered records; called on the thread of the file worker.
+void EditJournal::flush()
+{
+  QByteArray records;
+  bool isRestarting;
+
+  {
+    QMutexLocker locker { &mMutex };
+    records.swap(mBuffer);
+    isRestarting = mIsRestarting;
+    mIsRestarting = false;
+    mIsFlushQueued = false;
+  }
+
+  if (!mFile.isOpen()) return;
+
+  if (isRestarting && !mFile.resize(0)) {
+    qCritical("Failed to start journal over: EditJournal::flush()");
+  }
+
+  if (!records.isEmpty() && mFile.write(records) != records.size()) {
+    qCritical("Failed to write journal: EditJournal::flush()");
+  }
+}
+
+// Replays the journals which their sessions left behind, and returns the
+// notes written from them.
+QStringList EditJournal::recover(const QDir& dir, const QDir& noteDirectory, NoteStore* store)
+{
+  QStringList recovered;
+
+  for (const auto& fileName : dir.entryList(QStringList("*" + SUFFIX), QDir::Files)) {
+    QString journalPath { dir.filePath(fileName) };
+    QLockFile lock { journalPath + ".lock" };
+
+    // the session is still running
+    if (!lock.tryLock(0)) continue;
+
+    recovered += replay(journalPath, noteDirectory, store);
+    QFile::remove(journalPath);
+  }
+
+  return recovered;
+}
+
+// For every note, the edits are applied on top of the latest base which
+// the note file still matches. A save which did not complete leaves the
+// file at an older base, and the edits since then are applied again.
+QStringList EditJournal::replay(const QString& journalPath, const QDir& noteDirectory, NoteStore* store)
+{
+  struct Edit { qint32 position; qint32 charsRemoved; QString inserted; };
+
+  QFile file { journalPath };
+
+  if (!file.open(QIODevice::ReadOnly)) return QStringList();
+
+  QDataStream in { &file };
+  in.setVersion(QDataStream::Qt_5_0);
+
+  QHash<QString, QVector<QPair<QByteArray, int>>> bases;
+  QHash<QString, QVector<Edit>> edits;
+  QString path;
+
+  // a record torn by the crash ends the journal
+  while (!in.atEnd()) {
+    quint8 type;
+    in >> type;
+
+    if (type == BaseRecord) {
+      QByteArray hash;
+      in >> path >> hash;
+
+      if (in.status() != QDataStream::Ok) break;
+
+      bases[path].append(qMakePair(hash, edits[path].count()));
+    } else if (type == EditRecord) {
+      Edit edit;
+      in >> edit.position >> edit.charsRemoved >> edit.inserted;
+
+      if (in.status() != QDataStream::Ok) break;
+
+      if (bases.contains(path)) edits[path].append(edit);
+    } else {
+      break;
+    }
+  }
+
+  QStringList recovered;
+
+  for (auto i { bases.constBegin() }; i != bases.constEnd(); ++i) {
+    bool isNewNote { i.key().isEmpty() };
+
+    // a note deleted or moved afterwards is left alone
+    if (!isNewNote && !store->exists(i.key())) continue;
+
+    QString text { isNewNote ? QString() : store->load(i.key()) };
+    QByteArray hash { NoteFile::hash(text) };
+    const QVector<Edit>& noteEdits { edits.value(i.key()) };
+    int from { -1 };
+
+    for (int base { i.value().count() - 1 }; base >= 0; --base) {
+      if (isNewNote || i.value().at(base).first == hash) {
+	from = i.value().at(base).second;
+	break;
+      }
+    }
+
+    if (from < 0 || from == noteEdits.count()) continue;
+
+    for (int edit { from }; edit < noteEdits.count(); ++edit) {
+      const Edit& e { noteEdits.at(edit) };
+      int position { qBound(0, e.position, text.length()) };
+      text.replace(position, qBound(0, e.charsRemoved, text.length() - position), e.inserted);
+    }
+
+    QString notePath { i.key() };
+
+    if (isNewNote) {
+      if (text.trimmed().isEmpty()) continue;
+
+      qint64 time { QDateTime::currentMSecsSinceEpoch() };
+
+      do {
+	notePath = noteDirectory.filePath(QString::number(time++) + ".txt");
+      } while (store->exists(notePath));
+    }
+
+    if (store->save(notePath, text)) {
+      recovered.append(notePath);
+    } else {
+      qCritical("Failed to recover a note: EditJournal::replay()");
+    }
+  }
+
+  return recovered;
+}
@@ -0,0 +1,83 @@
+// qMemo/editjournal.hpp - write-ahead journal of the edits to notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+
+class NoteStore;
+
+
+// Records every edit of the editor in an append-only file, so that edits
+// made since the last save survive a crash. Each session writes its own
+// journal, locked while the session runs. A base record names the note
+// and the hash of the text which the following edits apply to; notes
+// without a file yet have an empty path. Records are buffered by the
+// editor and written by the file worker, so those which arrive while the
+// disk is busy are written at once.
+class EditJournal
+{
+public:
+  EditJournal();
+  ~EditJournal();
+  EditJournal(const EditJournal& other) = delete;
+  EditJournal& operator=(const EditJournal& other) = delete;
+
+  void checkpoint(const QString& path, const QByteArray& hash);
+  void compact(const QString& path, const QByteArray& hash);
+  void discard();
+  void flush();
+  bool isTracking(const QString& path) const;
+  bool queueFlush();
+  void recordEdit(int position, int charsRemoved, const QString& inserted);
+  bool start(const QDir& dir);
+
+  static QStringList recover(const QDir& dir, const QDir& noteDirectory, NoteStore* store);
+
+private:
+  enum RecordType : quint8 { BaseRecord = 1, EditRecord = 2 };
+
+  void write(const QByteArray& record);
+  void writeBase(const QString& path, const QByteArray& hash);
+
+  static QStringList replay(const QString& journalPath, const QDir& noteDirectory, NoteStore* store);
+
+  QFile mFile;
+  QScopedPointer<QLockFile> mLock;
+  QString mPath;
+  QByteArray mHash;
+  bool mHasBase;
+  QHash<QString, QByteArray> mUnsaved;
+  qint64 mSize;
+  QMutex mMutex;
+  QByteArray mBuffer;
+  bool mIsRestarting;
+  bool mIsFlushQueued;
+
+  static const QString SUFFIX;
+  static const qint64 COMPACT_SIZE;
+};
@@ -0,0 +1,203 @@
+// qMemo/fileindex.cpp - persistent metadata index of a note directory
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "fileindex.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+
+
+const quint32 FileIndex::MAGIC { 0x514d4958 }; // "QMIX"
+const quint32 FileIndex::VERSION { 1 };
+
+FileIndex::FileIndex()
+  : mDirectory(), mIndexPath(), mDirectoryModified(-1), mEntries(), mModified(false)
+{
+}
+
+// The index must live outside the indexed directory, otherwise writing it
+// would change the directory mtime which it records.
+void FileIndex::setLocation(const QDir& dir, const QString& indexPath)
+{
+  mDirectory = dir;
+  mIndexPath = indexPath;
+}
+
+void FileIndex::clear()
+{
+  mEntries.clear();
+  mDirectoryModified = -1;
+  mModified = true;
+}
+
+QVector<IndexEntry> FileIndex::entries() const
+{
+  QVector<IndexEntry> list;
+  list.reserve(mEntries.count());
+
+  for (const auto& entry : mEntries) {
+    list.append(entry);
+  }
+
+  return list;
+}
+
+const IndexEntry* FileIndex::find(const QString& fileName) const
+{
+  auto found { mEntries.constFind(fileName) };
+
+  return found == mEntries.constEnd() ? nullptr : &found.value();
+}
+
+void FileIndex::insert(const IndexEntry& entry)
+{
+  mEntries.insert(entry.fileName, entry);
+  mModified = true;
+}
+
+void FileIndex::remove(const QString& fileName)
+{
+  if (mEntries.remove(fileName) > 0) {
+    mModified = true;
+  }
+}
+
+qint64 FileIndex::modifiedOf(const QDir& dir)
+{
+  QFileInfo dirInfo { dir.absolutePath() };
+
+  return dirInfo.lastModified().toMSecsSinceEpoch();
+}
+
+// Makes the next scan list the directory again, instead of trusting the
+// entries.
+void FileIndex::invalidate()
+{
+  mDirectoryModified = -1;
+  mModified = true;
+}
+
+bool FileIndex::isDirectoryUnchanged() const
+{
+  return mDirectoryModified >= 0 && mDirectoryModified == modifiedOf(mDirectory);
+}
+
+// Takes the mtime of the directory from before it was listed. Our own
+// changes are not recorded, as another program may change the directory
+// at the same time, so the next scan lists the directory again.
+void FileIndex::markComplete(qint64 directoryModified)
+{
+  mDirectoryModified = directoryModified;
+  mModified = true;
+}
+
+bool FileIndex::isUpToDate(const IndexEntry& entry, const IndexEntry& listed)
+{
+  return entry.size == listed.size && entry.modified == listed.modified;
+}
+
+// Drops the entries from memory once they are saved, until load() reads
+// them again.
+bool FileIndex::unload()
+{
+  if (!save()) return false;
+
+  mEntries.clear();
+  mEntries.squeeze();
+  mDirectoryModified = -1;
+  return true;
+}
+
+bool FileIndex::load()
+{
+  mEntries.clear();
+  mDirectoryModified = -1;
+  mModified = false;
+
+  QFile file { mIndexPath };
+
+  if (!file.open(QIODevice::ReadOnly)) {
+    qInfo("No index found: FileIndex::load()");
+    return false;
+  }
+
+  QDataStream in { &file };
+  in.setVersion(QDataStream::Qt_5_0);
+
+  quint32 magic;
+  quint32 version;
+  qint64 directoryModified;
+  quint32 count;
+  in >> magic >> version >> directoryModified >> count;
+
+  if (in.status() != QDataStream::Ok || magic != MAGIC || version != VERSION) {
+    qWarning("Ignored broken index: FileIndex::load()");
+    return false;
+  }
+
+  mEntries.reserve(count);
+
+  for (quint32 i { 0 }; i < count; ++i) {
+    QByteArray fileName;
+    IndexEntry entry;
+    in >> fileName >> entry.size >> entry.modified >> entry.preview;
+
+    if (in.status() != QDataStream::Ok) {
+      qWarning("Ignored broken index: FileIndex::load()");
+      mEntries.clear();
+      return false;
+    }
+
+    entry.fileName = QString::fromUtf8(fileName);
+    mEntries.insert(entry.fileName, entry);
+  }
+
+  mDirectoryModified = directoryModified;
+  return true;
+}
+
+bool FileIndex::save()
+{
+  if (!mModified) return true;
+
+  QSaveFile file { mIndexPath };
+
+  if (!file.open(QIODevice::WriteOnly)) {
+    qCritical("Failed to open index: FileIndex::save()");
+    return false;
+  }
+
+  QDataStream out { &file };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << MAGIC << VERSION << mDirectoryModified << static_cast<quint32>(mEntries.count());
+
+  for (const auto& entry : mEntries) {
+    out << entry.fileName.toUtf8() << entry.size << entry.modified << entry.preview;
+  }
+
+  if (!file.commit()) {
+    qCritical("Failed to write index: FileIndex::save()");
+    return false;
+  }
+
+  mModified = false;
+  return true;
+}
@@ -0,0 +1,74 @@
+// qMemo/fileindex.hpp - persistent metadata index of a note directory
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMetaType>
+#include <QString>
+#include <QVector>
+
+
+struct IndexEntry
+{
+  QString fileName;
+  qint64 size;
+  qint64 modified;
+  QByteArray preview; // UTF-8, decoded only when shown
+};
+
+Q_DECLARE_METATYPE(IndexEntry)
+
+
+// Keeps size, mtime and preview of every note in a directory, so that
+// notes which have not changed since the last run need not be opened.
+class FileIndex
+{
+public:
+  FileIndex();
+
+  void clear();
+  QVector<IndexEntry> entries() const;
+  const IndexEntry* find(const QString& fileName) const;
+  void insert(const IndexEntry& entry);
+  void invalidate();
+  bool isDirectoryUnchanged() const;
+  bool load();
+  void markComplete(qint64 directoryModified);
+  void remove(const QString& fileName);
+  bool save();
+  void setLocation(const QDir& dir, const QString& indexPath);
+  bool unload();
+
+  static bool isUpToDate(const IndexEntry& entry, const IndexEntry& listed);
+  static qint64 modifiedOf(const QDir& dir);
+
+private:
+  QDir mDirectory;
+  QString mIndexPath;
+  qint64 mDirectoryModified;
+  QHash<QString, IndexEntry> mEntries;
+  bool mModified;
+
+  static const quint32 MAGIC;
+  static const quint32 VERSION;
+};
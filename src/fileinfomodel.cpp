@@ -19,20 +19,161 @@
 
 #include "fileinfomodel.hpp"
 
+#include <QDateTime>
+#include <QFileInfo>
+#include <cstring>
+
+
+const QString FileInfoModel::TIMESTAMP_PATTERN { "yyyy-MM-dd HH:mm:ss" };
+const int FileInfoModel::TITLE_LENGTH { 64 };
+const int FileInfoModel::PREVIEW_CACHE_SIZE { 2048 };
+const int FileInfoModel::COMPACT_SIZE { 1 << 20 };
 
 FileInfoModel::FileInfoModel(QObject *parent)
   : QAbstractListModel(parent),
-    mList()
+    mDirectoryIds(), mNameOffsets(), mNameLengths(), mPreviewOffsets(), mPreviewLengths(),
+    mModified(), mSizes(), mCreated(), mVersions(),
+    mDirectories(), mNames(), mPreviews(), mGarbage(0), mRows(),
+    mCollator(), mHasTitleKeys(false), mTitleKeys(),
+    mDecodedPreviews(PREVIEW_CACHE_SIZE)
+{
+  mCollator.setNumericMode(true);
+  mCollator.setCaseSensitivity(Qt::CaseInsensitive);
+}
+
+// Versions are unique across all models, so that a version stands for
+// the contents of a row wherever it is shown.
+quint32 FileInfoModel::nextVersion()
 {
+  static quint32 version { 0 };
+
+  return ++version;
 }
 
-void FileInfoModel::appendItem(const QUrl& fileURL, const QString& modified, const QString& preview)
+void FileInfoModel::appendItem(const QUrl& fileURL, qint64 modified, qint64 size, const QByteArray& preview)
 {
   beginInsertRows(QModelIndex(), rowCount(), rowCount());
-  mList.append(PreviewItem { fileURL.toString(), modified, preview } );
+  insertItem(fileURL.toLocalFile(), modified, size, preview);
   endInsertRows();
 }
 
+void FileInfoModel::appendItems(const QDir& dir, const QVector<IndexEntry>& entries)
+{
+  if (entries.isEmpty()) return;
+
+  beginInsertRows(QModelIndex(), rowCount(), rowCount() + entries.count() - 1);
+
+  for (const auto& entry : entries) {
+    insertItem(dir.filePath(entry.fileName), entry.modified, entry.size, entry.preview);
+  }
+
+  endInsertRows();
+}
+
+void FileInfoModel::clear()
+{
+  beginResetModel();
+
+  for (auto column : { &mNameOffsets, &mPreviewOffsets, &mVersions }) {
+    column->clear();
+    column->squeeze();
+  }
+
+  for (auto column : { &mModified, &mSizes, &mCreated }) {
+    column->clear();
+    column->squeeze();
+  }
+
+  mDirectoryIds.clear();
+  mDirectoryIds.squeeze();
+  mNameLengths.clear();
+  mNameLengths.squeeze();
+  mPreviewLengths.clear();
+  mPreviewLengths.squeeze();
+  mDirectories.clear();
+  mNames.clear();
+  mNames.squeeze();
+  mPreviews.clear();
+  mPreviews.squeeze();
+  mGarbage = 0;
+  mRows.clear();
+  mRows.squeeze();
+  mTitleKeys.clear();
+  mTitleKeys.shrink_to_fit();
+  mDecodedPreviews.clear();
+  endResetModel();
+}
+
+// A note is kept in a few integers, whose columns hold no pointers.
+// Directories are kept once, and file names and previews are UTF-8 in
+// two arenas. Every change of an item gives it a new version, which
+// tells views that a rendering of it is out of date.
+void FileInfoModel::insertItem(const QString& path, qint64 modified, qint64 size, const QByteArray& preview)
+{
+  int slash { path.lastIndexOf('/') };
+  QString directory { path.left(slash) };
+  QByteArray name { path.mid(slash + 1).toUtf8().left(255) };
+  int directoryId { mDirectories.indexOf(directory) };
+
+  if (directoryId < 0) {
+    directoryId = mDirectories.count();
+    mDirectories.append(directory);
+  }
+
+  mRows.insert(qHash(name), mVersions.count());
+  mDirectoryIds.append(static_cast<quint16>(directoryId));
+  mNameOffsets.append(static_cast<quint32>(mNames.size()));
+  mNameLengths.append(static_cast<quint8>(name.size()));
+  mNames.append(name);
+  mPreviewOffsets.append(0);
+  mPreviewLengths.append(0);
+  mModified.append(modified);
+  mSizes.append(size);
+  mCreated.append(createdTimeOf(QString::fromUtf8(name), modified));
+  mVersions.append(nextVersion());
+  setPreview(mVersions.count() - 1, preview);
+
+  if (mHasTitleKeys) {
+    mTitleKeys.push_back(titleKey(mVersions.count() - 1));
+  }
+}
+
+// The old preview is left in the arena until it is compacted.
+void FileInfoModel::setPreview(int row, const QByteArray& preview)
+{
+  mGarbage += mPreviewLengths.at(row);
+  mPreviewOffsets[row] = static_cast<quint32>(mPreviews.size());
+  mPreviewLengths[row] = static_cast<quint16>(qMin(preview.size(), 0xffff));
+  mPreviews.append(preview.constData(), mPreviewLengths.at(row));
+}
+
+// Copies the file names and previews which rows still refer to, once
+// most of the arenas are left over.
+void FileInfoModel::compactArenas()
+{
+  if (mGarbage < COMPACT_SIZE || mGarbage * 2 < mNames.size() + mPreviews.size()) return;
+
+  QByteArray names;
+  QByteArray previews;
+  names.reserve(mNames.size());
+  previews.reserve(mPreviews.size() - static_cast<int>(qMin<qint64>(mGarbage, mPreviews.size())));
+
+  for (int row { 0 }; row < mVersions.count(); ++row) {
+    quint32 nameOffset { static_cast<quint32>(names.size()) };
+    names.append(mNames.constData() + mNameOffsets.at(row), mNameLengths.at(row));
+    mNameOffsets[row] = nameOffset;
+    quint32 previewOffset { static_cast<quint32>(previews.size()) };
+    previews.append(mPreviews.constData() + mPreviewOffsets.at(row), mPreviewLengths.at(row));
+    mPreviewOffsets[row] = previewOffset;
+  }
+
+  names.squeeze();
+  previews.squeeze();
+  mNames.swap(names);
+  mPreviews.swap(previews);
+  mGarbage = 0;
+}
+
 /*
 void FileInfoModel::prependItem(const QUrl& fileURL, const QString& modified, const QString& preview)
 {
@@ -42,20 +183,174 @@ void FileInfoModel::prependItem(const QUrl& fileURL, const QString& modified, co
 }
 */
 
-void FileInfoModel::modifyItem(const QUrl& fileURL, const QString& modified, const QString& preview)
+void FileInfoModel::modifyItem(const QUrl& fileURL, qint64 modified, qint64 size, const QByteArray& preview)
+{
+  int row { findRow(fileURL.toLocalFile()) };
+
+  if (row >= 0) {
+    mModified[row] = modified;
+    mSizes[row] = size;
+    mVersions[row] = nextVersion();
+    setPreview(row, preview);
+
+    if (mHasTitleKeys) {
+      mTitleKeys[row] = titleKey(row);
+    }
+
+    compactArenas();
+    emit dataChanged(index(row), index(row));
+  }
+}
+
+// The creation time is part of the name of a note, "<msecs>.txt".
+qint64 FileInfoModel::createdTimeOf(const QString& fileName, qint64 modified)
+{
+  bool isNumber { false };
+  qint64 created { QFileInfo(fileName).baseName().toLongLong(&isNumber) };
+
+  return isNumber ? created : modified;
+}
+
+QByteArray FileInfoModel::nameOf(int row) const
 {
-  for (int i { 0 }; i < rowCount(); ++i) {
-    PreviewItem& item { mList[i] };
+  return QByteArray::fromRawData(mNames.constData() + mNameOffsets.at(row), mNameLengths.at(row));
+}
+
+QString FileInfoModel::filePath(int row) const
+{
+  return mDirectories.at(mDirectoryIds.at(row)) + '/' + QString::fromUtf8(nameOf(row));
+}
+
+QUrl FileInfoModel::fileURL(int row) const
+{
+  return QUrl::fromLocalFile(filePath(row));
+}
+
+QByteArray FileInfoModel::previewBytes(int row) const
+{
+  return QByteArray(mPreviews.constData() + mPreviewOffsets.at(row), mPreviewLengths.at(row));
+}
 
-    if (item.fileURL == fileURL) {
-      item.modified = modified;
-      item.preview = preview;
-      emit dataChanged(index(i), index(i));
-      break;
+// Rows are found by the hash of their file names, and told apart by
+// their directories.
+int FileInfoModel::findRow(const QString& path) const
+{
+  int slash { path.lastIndexOf('/') };
+  QByteArray name { path.mid(slash + 1).toUtf8() };
+  int directoryId { mDirectories.indexOf(path.left(slash)) };
+
+  uint hash { qHash(name) };
+
+  if (directoryId < 0) return -1;
+
+  for (auto i { mRows.constFind(hash) }; i != mRows.constEnd() && i.key() == hash; ++i) {
+    if (mDirectoryIds.at(i.value()) == directoryId && nameOf(i.value()) == name) return i.value();
+  }
+
+  return -1;
+}
+
+void FileInfoModel::renumberRow(int from, int to)
+{
+  uint hash { qHash(nameOf(from)) };
+
+  for (auto i { mRows.find(hash) }; i != mRows.end() && i.key() == hash; ++i) {
+    if (i.value() == from) {
+      i.value() = to;
+      return;
     }
   }
 }
 
+// Bytes taken by the rows, without the title keys, which exist only
+// while the list is sorted by title. A QHash node holds a pointer to the
+// next one, the hash, the key and the value.
+qint64 FileInfoModel::memoryUsage() const
+{
+  qint64 bytes {
+    mDirectoryIds.capacity() * static_cast<qint64>(sizeof(quint16)) +
+    mNameOffsets.capacity() * static_cast<qint64>(sizeof(quint32)) +
+    mNameLengths.capacity() * static_cast<qint64>(sizeof(quint8)) +
+    mPreviewOffsets.capacity() * static_cast<qint64>(sizeof(quint32)) +
+    mPreviewLengths.capacity() * static_cast<qint64>(sizeof(quint16)) +
+    (mModified.capacity() + mSizes.capacity() + mCreated.capacity()) * static_cast<qint64>(sizeof(qint64)) +
+    mVersions.capacity() * static_cast<qint64>(sizeof(quint32)) +
+    mNames.capacity() + mPreviews.capacity() +
+    mRows.capacity() * static_cast<qint64>(sizeof(void*)) +
+    mRows.size() * static_cast<qint64>(sizeof(void*) + sizeof(uint) * 2 + sizeof(int))
+  };
+
+  for (const auto& directory : mDirectories) {
+    bytes += directory.capacity() * static_cast<qint64>(sizeof(QChar));
+  }
+
+  return bytes;
+}
+
+// Title keys are built only while some view sorts by title, as they cost
+// time on every insertion and memory for every note.
+void FileInfoModel::setTitleKeysEnabled(bool b)
+{
+  if (b == mHasTitleKeys) return;
+
+  mHasTitleKeys = b;
+  mTitleKeys.clear();
+
+  if (b) {
+    mTitleKeys.reserve(mVersions.count());
+
+    for (int row { 0 }; row < mVersions.count(); ++row) {
+      mTitleKeys.push_back(titleKey(row));
+    }
+  } else {
+    mTitleKeys.shrink_to_fit();
+  }
+}
+
+QCollatorSortKey FileInfoModel::titleKey(int row) const
+{
+  return mCollator.sortKey(titleOf(row));
+}
+
+// No character takes more than four bytes, so only that many are decoded.
+QString FileInfoModel::titleOf(int row) const
+{
+  return QString::fromUtf8(mPreviews.constData() + mPreviewOffsets.at(row),
+			   qMin(static_cast<int>(mPreviewLengths.at(row)), 4 * TITLE_LENGTH)).left(TITLE_LENGTH);
+}
+
+// Previews are kept in UTF-8 and decoded for the rows which the view
+// asks for, which are the ones on the screen. The latest PREVIEW_CACHE_SIZE
+// of them are kept, the others are dropped as the list scrolls.
+QString FileInfoModel::previewOf(int row) const
+{
+  QString* cached { mDecodedPreviews.object(mVersions.at(row)) };
+
+  if (cached) return *cached;
+
+  QString preview { QString::fromUtf8(mPreviews.constData() + mPreviewOffsets.at(row), mPreviewLengths.at(row)) };
+  mDecodedPreviews.insert(mVersions.at(row), new QString(preview));
+  return preview;
+}
+
+// File names are unique in a directory, so they order rows whose sort
+// keys are equal, whatever their numbers.
+int FileInfoModel::compareNames(int left, int right) const
+{
+  int length { qMin(mNameLengths.at(left), mNameLengths.at(right)) };
+  int result { std::memcmp(mNames.constData() + mNameOffsets.at(left), mNames.constData() + mNameOffsets.at(right),
+			   static_cast<size_t>(length)) };
+
+  return result != 0 ? result : mNameLengths.at(left) - mNameLengths.at(right);
+}
+
+int FileInfoModel::compareTitles(int left, int right) const
+{
+  return mHasTitleKeys ?
+    mTitleKeys[left].compare(mTitleKeys[right]) :
+    mCollator.compare(titleOf(left), titleOf(right));
+}
+
 bool FileInfoModel::dynamicRoles() const
 {
   return false;
@@ -67,6 +362,10 @@ QHash<int, QByteArray> FileInfoModel::roleNames() const
   roles[FileURLRole] = "fileURL";
   roles[ModifiedRole] = "modified";
   roles[PreviewRole] = "preview";
+  roles[ModifiedTimeRole] = "modifiedTime";
+  roles[CreatedTimeRole] = "createdTime";
+  roles[SizeRole] = "size";
+  roles[VersionRole] = "version";
 
   return roles;
 }
@@ -75,40 +374,231 @@ int FileInfoModel::rowCount(const QModelIndex &parent) const
 {
   Q_UNUSED(parent);
 
-  return mList.count();
+  return mVersions.count();
 }
 
 QVariant FileInfoModel::data(const QModelIndex &index, int role) const
 {
   int dataIndex { index.row() };
 
-  if (dataIndex < 0 || dataIndex >= mList.count()) {
+  if (dataIndex < 0 || dataIndex >= mVersions.count()) {
     return QVariant();
   }
 
   return
-    role == FileURLRole ? QVariant(mList.at(dataIndex).fileURL) :
-    role == ModifiedRole ? QVariant(mList.at(dataIndex).modified) :
-    role == PreviewRole ? QVariant(mList.at(dataIndex).preview) :
+    role == FileURLRole ? QVariant(fileURL(dataIndex)) :
+    role == ModifiedRole ? QVariant(QDateTime::fromMSecsSinceEpoch(mModified.at(dataIndex)).toString(TIMESTAMP_PATTERN)) :
+    role == PreviewRole ? QVariant(previewOf(dataIndex)) :
+    role == ModifiedTimeRole ? QVariant(mModified.at(dataIndex)) :
+    role == CreatedTimeRole ? QVariant(mCreated.at(dataIndex)) :
+    role == SizeRole ? QVariant(mSizes.at(dataIndex)) :
+    role == VersionRole ? QVariant(mVersions.at(dataIndex)) :
     role == Qt::EditRole ? QVariant(16) :
     QVariant();
 }
 
+// The last row takes the place of the removed one, so the model moves
+// no other row and its cost does not depend on where the row is. The
+// exchange is announced as a layout change for any view or proxy.
+// FileInfoProxy follows it through rowsRenumbered() without sorting
+// again, and only closes the gap which the note leaves in its order,
+// which is linear in the rows below it.
 QModelIndex FileInfoModel::removeItem(const QUrl& path)
 {
-  QString pathString { path.toString() };
+  int row { findRow(path.toLocalFile()) };
+
+  if (row < 0) return QModelIndex();
+
+  auto index { this->index(row) };
+  int last { mVersions.count() - 1 };
+  mRows.remove(qHash(nameOf(row)), row);
+
+  if (row != last) {
+    emit rowsAboutToBeRenumbered();
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), VerticalSortHint);
+    renumberRow(last, row);
+    swapRows(row, last);
+    changePersistentIndexList({ this->index(row), this->index(last) }, { this->index(last), this->index(row) });
+    emit rowsRenumbered({ row, last }, { last, row });
+    emit layoutChanged(QList<QPersistentModelIndex>(), VerticalSortHint);
+  }
+
+  beginRemoveRows(QModelIndex(), last, last);
+  mGarbage += mNameLengths.at(last) + mPreviewLengths.at(last);
+  mDirectoryIds.removeLast();
+  mNameOffsets.removeLast();
+  mNameLengths.removeLast();
+  mPreviewOffsets.removeLast();
+  mPreviewLengths.removeLast();
+  mModified.removeLast();
+  mSizes.removeLast();
+  mCreated.removeLast();
+  mVersions.removeLast();
+
+  if (mHasTitleKeys) {
+    mTitleKeys.pop_back();
+  }
+
+  compactArenas();
+  endRemoveRows();
+  return index;
+}
+
+// The rows to go are first moved behind the others, keeping their order,
+// so that they leave as one range and the views are updated once,
+// however the rows are spread. Returns the number of removed rows.
+int FileInfoModel::removeItems(const QList<QUrl>& paths)
+{
+  QVector<bool> isRemoved(mVersions.count(), false);
+  int count { 0 };
+
+  for (const auto& path : paths) {
+    int row { findRow(path.toLocalFile()) };
 
-  for (int i { 0 }; i < mList.count(); ++i) {
-    if (mList[i].fileURL == pathString) {
-      auto index { this->index(i) };
-      beginRemoveRows(QModelIndex(), i, i);
-      mList.removeAt(i);
-      endRemoveRows();
-      return index;
+    if (row >= 0 && !isRemoved.at(row)) {
+      isRemoved[row] = true;
+      ++count;
     }
   }
 
-  return QModelIndex();
+  if (count == 0) return 0;
+
+  int first { mVersions.count() - count };
+
+  if (isRemoved.indexOf(true) < first) {
+    // the old row of every new one
+    QVector<int> order;
+    order.reserve(mVersions.count());
+
+    for (bool removed : { false, true }) {
+      for (int row { 0 }; row < mVersions.count(); ++row) {
+	if (isRemoved.at(row) == removed) order.append(row);
+      }
+    }
+
+    QVector<int> rows;
+    QVector<int> newRows;
+
+    for (int row { 0 }; row < order.count(); ++row) {
+      if (order.at(row) != row) {
+	rows.append(order.at(row));
+	newRows.append(row);
+      }
+    }
+
+    QVector<int> newRowOf(order.count());
+
+    for (int row { 0 }; row < order.count(); ++row) {
+      newRowOf[order.at(row)] = row;
+    }
+
+    emit rowsAboutToBeRenumbered();
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), VerticalSortHint);
+    QModelIndexList from { persistentIndexList() };
+    QModelIndexList to;
+
+    for (const auto& index : from) {
+      to.append(this->index(newRowOf.at(index.row())));
+    }
+
+    reorderRows(order);
+    changePersistentIndexList(from, to);
+    emit rowsRenumbered(rows, newRows);
+    emit layoutChanged(QList<QPersistentModelIndex>(), VerticalSortHint);
+  }
+
+  beginRemoveRows(QModelIndex(), first, mVersions.count() - 1);
+
+  for (int row { first }; row < mVersions.count(); ++row) {
+    mRows.remove(qHash(nameOf(row)), row);
+    mGarbage += mNameLengths.at(row) + mPreviewLengths.at(row);
+  }
+
+  mDirectoryIds.resize(first);
+  mNameOffsets.resize(first);
+  mNameLengths.resize(first);
+  mPreviewOffsets.resize(first);
+  mPreviewLengths.resize(first);
+  mModified.resize(first);
+  mSizes.resize(first);
+  mCreated.resize(first);
+  mVersions.resize(first);
+
+  if (mHasTitleKeys) {
+    mTitleKeys.erase(mTitleKeys.begin() + first, mTitleKeys.end());
+  }
+
+  compactArenas();
+  endRemoveRows();
+  return count;
+}
+
+// Exchanges the data of two rows; mRows is left to the caller.
+void FileInfoModel::swapRows(int row, int other)
+{
+  std::swap(mDirectoryIds[row], mDirectoryIds[other]);
+  std::swap(mNameOffsets[row], mNameOffsets[other]);
+  std::swap(mNameLengths[row], mNameLengths[other]);
+  std::swap(mPreviewOffsets[row], mPreviewOffsets[other]);
+  std::swap(mPreviewLengths[row], mPreviewLengths[other]);
+  std::swap(mModified[row], mModified[other]);
+  std::swap(mSizes[row], mSizes[other]);
+  std::swap(mCreated[row], mCreated[other]);
+  std::swap(mVersions[row], mVersions[other]);
+
+  if (mHasTitleKeys) {
+    mTitleKeys[static_cast<size_t>(row)].swap(mTitleKeys[static_cast<size_t>(other)]);
+  }
+}
+
+template <typename T>
+void FileInfoModel::reorder(QVector<T>& column, const QVector<int>& order)
+{
+  QVector<T> reordered;
+  reordered.reserve(column.count());
+
+  for (int row : order) {
+    reordered.append(column.at(row));
+  }
+
+  column.swap(reordered);
+}
+
+// Puts the old row order[i] at row i. The names and previews stay where
+// they are in the arenas.
+void FileInfoModel::reorderRows(const QVector<int>& order)
+{
+  reorder(mDirectoryIds, order);
+  reorder(mNameOffsets, order);
+  reorder(mNameLengths, order);
+  reorder(mPreviewOffsets, order);
+  reorder(mPreviewLengths, order);
+  reorder(mModified, order);
+  reorder(mSizes, order);
+  reorder(mCreated, order);
+  reorder(mVersions, order);
+
+  if (mHasTitleKeys) {
+    std::vector<QCollatorSortKey> keys;
+    keys.reserve(mTitleKeys.size());
+
+    for (int row : order) {
+      keys.push_back(mTitleKeys.at(static_cast<size_t>(row)));
+    }
+
+    mTitleKeys.swap(keys);
+  }
+
+  mRows.clear();
+
+  for (int row { 0 }; row < mVersions.count(); ++row) {
+    mRows.insert(qHash(nameOf(row)), row);
+  }
+}
+
+int FileInfoModel::rowOf(const QUrl& fileURL) const
+{
+  return findRow(fileURL.toLocalFile());
 }
 
 QVariant FileInfoModel::get(const QModelIndex& index, const QString& role) const
@@ -116,10 +606,10 @@ QVariant FileInfoModel::get(const QModelIndex& index, const QString& role) const
   int dataIndex { index.row() };
 
   return
-    (dataIndex < 0 || dataIndex >= mList.count()) ? QVariant() :
-    role == "fileURL" ? QVariant(mList.at(dataIndex).fileURL) :
-    role == "modified" ? QVariant(mList.at(dataIndex).modified) :
-    role == "preview" ? QVariant(mList.at(dataIndex).preview) :
+    (dataIndex < 0 || dataIndex >= mVersions.count()) ? QVariant() :
+    role == "fileURL" ? QVariant(fileURL(dataIndex)) :
+    role == "modified" ? QVariant(QDateTime::fromMSecsSinceEpoch(mModified.at(dataIndex)).toString(TIMESTAMP_PATTERN)) :
+    role == "preview" ? QVariant(previewOf(dataIndex)) :
     QVariant();
 }
 
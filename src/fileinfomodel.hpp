@@ -20,17 +20,16 @@
 #pragma once
 
 #include <QAbstractListModel>
-#include <QList>
+#include <QCache>
+#include <QCollator>
+#include <QDir>
+#include <QHash>
+#include <QMultiHash>
 #include <QStringList>
 #include <QUrl>
-
-
-struct PreviewItem
-{
-  QUrl fileURL;
-  QString modified;
-  QString preview;
-};
+#include <QVector>
+#include <vector>
+#include "fileindex.hpp"
 
 
 class FileInfoModel : public QAbstractListModel
@@ -42,6 +41,10 @@ public:
     FileURLRole = Qt::UserRole + 1,
     ModifiedRole,
     PreviewRole,
+    ModifiedTimeRole,
+    CreatedTimeRole,
+    SizeRole,
+    VersionRole,
   };
 
   explicit FileInfoModel(QObject* parent = 0);
@@ -51,18 +54,78 @@ public:
   int rowCount(const QModelIndex& parent = QModelIndex()) const override;
 
 
-  void appendItem(const QUrl& fileURL, const QString& modified, const QString& preview);
+  void appendItem(const QUrl& fileURL, qint64 modified, qint64 size, const QByteArray& preview);
+  void appendItems(const QDir& dir, const QVector<IndexEntry>& entries);
+  void clear();
+  int compareNames(int left, int right) const;
+  int compareTitles(int left, int right) const;
   bool dynamicRoles() const;
+  QString filePath(int row) const;
+  QUrl fileURL(int row) const;
+  int findRow(const QString& path) const;
   QVariant get(const QModelIndex& index, const QString& role) const;
-  void modifyItem(const QUrl& fileURL, const QString& modified, const QString& preview);
+  qint64 memoryUsage() const;
+  void modifyItem(const QUrl& fileURL, qint64 modified, qint64 size, const QByteArray& preview);
+  QByteArray previewBytes(int row) const;
   QModelIndex removeItem(const QUrl& path);
+  int removeItems(const QList<QUrl>& paths);
+  int rowOf(const QUrl& fileURL) const;
+  void setTitleKeysEnabled(bool b);
+
+  // sort keys for FileInfoProxy, without going through QVariant
+  qint64 createdTime(int row) const { return mCreated.at(row); }
+  qint64 modifiedTime(int row) const { return mModified.at(row); }
+  qint64 size(int row) const { return mSizes.at(row); }
+  QByteArray nameOf(int row) const; // raw, valid until the model changes
 
 signals:
   void countChanged();
+  // announced as a layout change as well, which a proxy following these
+  // may skip; rows[i] is now newRows[i], and the rows keep their data
+  void rowsAboutToBeRenumbered();
+  void rowsRenumbered(const QVector<int>& rows, const QVector<int>& newRows);
 
 protected:
   QHash<int, QByteArray> roleNames() const override;
 
 private:
-  QList<PreviewItem> mList;
+  void compactArenas();
+  void insertItem(const QString& path, qint64 modified, qint64 size, const QByteArray& preview);
+  QString previewOf(int row) const;
+  void renumberRow(int from, int to);
+  void reorderRows(const QVector<int>& order);
+  void swapRows(int row, int other);
+  void setPreview(int row, const QByteArray& preview);
+  QCollatorSortKey titleKey(int row) const;
+  QString titleOf(int row) const;
+
+  static qint64 createdTimeOf(const QString& fileName, qint64 modified);
+  static quint32 nextVersion();
+  template <typename T> static void reorder(QVector<T>& column, const QVector<int>& order);
+
+  // one element for every note, in the order of the rows
+  QVector<quint16> mDirectoryIds;
+  QVector<quint32> mNameOffsets;
+  QVector<quint8> mNameLengths;
+  QVector<quint32> mPreviewOffsets;
+  QVector<quint16> mPreviewLengths;
+  QVector<qint64> mModified;
+  QVector<qint64> mSizes;
+  QVector<qint64> mCreated;
+  QVector<quint32> mVersions;
+
+  QStringList mDirectories;
+  QByteArray mNames; // UTF-8
+  QByteArray mPreviews; // UTF-8
+  qint64 mGarbage;
+  QMultiHash<uint, int> mRows; // by the hash of the file name
+  QCollator mCollator;
+  bool mHasTitleKeys;
+  std::vector<QCollatorSortKey> mTitleKeys;
+  mutable QCache<quint32, QString> mDecodedPreviews; // by version
+
+  static const QString TIMESTAMP_PATTERN;
+  static const int TITLE_LENGTH;
+  static const int PREVIEW_CACHE_SIZE;
+  static const int COMPACT_SIZE;
 };
@@ -19,39 +19,530 @@
 
 #include "fileinfoproxy.hpp"
 
-#include <QtWidgets>
+#include <algorithm>
+#include <functional>
 #include "fileinfomodel.hpp"
 
 
 FileInfoProxy::FileInfoProxy(QObject* parent)
-  : QSortFilterProxyModel(parent)
+  : QAbstractProxyModel(parent), mSortMode(ModifiedOrder), mSortOrder(Qt::DescendingOrder),
+    mIsFiltered(false), mAcceptedPaths(), mAcceptedNames(), mProxyToSource(), mSourceToProxy(), mIsRenumbering(false),
+    mLayoutIndexes(), mLayoutSourceIndexes()
 {
 }
 
 void FileInfoProxy::setFileInfoModel(FileInfoModel* model)
 {
-  QSortFilterProxyModel::setSourceModel(model);
+  setSourceModel(model);
+}
+
+void FileInfoProxy::setSourceModel(QAbstractItemModel* model)
+{
+  beginResetModel();
+
+  if (fileInfoModel()) {
+    disconnect(sourceModel(), nullptr, this, nullptr);
+    fileInfoModel()->setTitleKeysEnabled(false);
+  }
+
+  QAbstractProxyModel::setSourceModel(model);
+
+  if (model) {
+    static_cast<FileInfoModel*>(model)->setTitleKeysEnabled(mSortMode == TitleOrder);
+    connect(model, &QAbstractItemModel::dataChanged, this, &FileInfoProxy::onDataChanged);
+    connect(model, &QAbstractItemModel::layoutAboutToBeChanged, this, &FileInfoProxy::onLayoutAboutToBeChanged);
+    connect(model, &QAbstractItemModel::layoutChanged, this, &FileInfoProxy::onLayoutChanged);
+    connect(model, &QAbstractItemModel::modelReset, this, &FileInfoProxy::onModelReset);
+    connect(model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &FileInfoProxy::onRowsAboutToBeRemoved);
+    connect(model, &QAbstractItemModel::rowsInserted, this, &FileInfoProxy::onRowsInserted);
+    connect(model, &QAbstractItemModel::rowsRemoved, this, &FileInfoProxy::onRowsRemoved);
+    connect(static_cast<FileInfoModel*>(model), &FileInfoModel::rowsAboutToBeRenumbered,
+	    this, &FileInfoProxy::onRowsAboutToBeRenumbered);
+    connect(static_cast<FileInfoModel*>(model), &FileInfoModel::rowsRenumbered, this, &FileInfoProxy::onRowsRenumbered);
+  }
+
+  rebuild();
+  endResetModel();
 }
 
 FileInfoModel* FileInfoProxy::fileInfoModel() const
 {
-  return static_cast<FileInfoModel*>(QSortFilterProxyModel::sourceModel());
+  return static_cast<FileInfoModel*>(sourceModel());
+}
+
+FileInfoProxy::SortMode FileInfoProxy::sortMode() const
+{
+  return mSortMode;
+}
+
+// Titles are listed from A to Z, everything else from the newest or the
+// largest one.
+void FileInfoProxy::setSortMode(SortMode mode)
+{
+  mSortMode = mode;
+  mSortOrder = mode == TitleOrder ? Qt::AscendingOrder : Qt::DescendingOrder;
+
+  if (fileInfoModel()) {
+    fileInfoModel()->setTitleKeysEnabled(mode == TitleOrder);
+  }
+
+  relayout();
 }
 
-bool FileInfoProxy::filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const
+void FileInfoProxy::sort(int column, Qt::SortOrder order)
 {
-  Q_UNUSED(sourceRow);
-  Q_UNUSED(sourceParent);
-  return true;
+  Q_UNUSED(column);
+
+  mSortOrder = order;
+  relayout();
 }
 
-bool FileInfoProxy::lessThan(const QModelIndex& left, const QModelIndex& right) const
+bool FileInfoProxy::isFiltered() const
 {
-  QVariant leftData { sourceModel()->data(left, FileInfoModel::ModifiedRole) };
-  QVariant rightData { sourceModel()->data(right, FileInfoModel::ModifiedRole) };
+  return mIsFiltered;
+}
+
+// Shows only the given notes, of any directory. Only their rows are
+// sorted, so a search with a few hits costs little however long the
+// list is.
+void FileInfoProxy::setAcceptedFiles(const QSet<QString>& paths)
+{
+  mIsFiltered = true;
+  mAcceptedPaths = paths;
+  mAcceptedNames.clear();
+
+  for (const auto& path : paths) {
+    mAcceptedNames.insert(path.mid(path.lastIndexOf('/') + 1).toUtf8());
+  }
+
+  relayout();
+}
+
+// Shows some more notes without sorting the rest again.
+void FileInfoProxy::addAcceptedFiles(const QSet<QString>& paths)
+{
+  if (!mIsFiltered) return;
+
+  QVector<int> rows;
+
+  for (const auto& path : paths) {
+    if (mAcceptedPaths.contains(path)) continue;
+
+    mAcceptedPaths.insert(path);
+    mAcceptedNames.insert(path.mid(path.lastIndexOf('/') + 1).toUtf8());
+    int row { fileInfoModel() ? fileInfoModel()->findRow(path) : -1 };
+
+    if (row >= 0 && mSourceToProxy.at(row) < 0) {
+      rows.append(row);
+    }
+  }
+
+  insertSourceRows(rows);
+}
+
+void FileInfoProxy::clearFilter()
+{
+  if (!mIsFiltered) return;
+
+  mIsFiltered = false;
+  mAcceptedPaths.clear();
+  mAcceptedNames.clear();
+  relayout();
+}
+
+int FileInfoProxy::columnCount(const QModelIndex& parent) const
+{
+  return parent.isValid() ? 0 : 1;
+}
+
+bool FileInfoProxy::hasChildren(const QModelIndex& parent) const
+{
+  return !parent.isValid() && !mProxyToSource.isEmpty();
+}
+
+int FileInfoProxy::rowCount(const QModelIndex& parent) const
+{
+  return parent.isValid() ? 0 : mProxyToSource.count();
+}
+
+QModelIndex FileInfoProxy::index(int row, int column, const QModelIndex& parent) const
+{
+  if (parent.isValid() || column != 0 || row < 0 || row >= mProxyToSource.count()) {
+    return QModelIndex();
+  }
+
+  return createIndex(row, column);
+}
+
+QModelIndex FileInfoProxy::parent(const QModelIndex& child) const
+{
+  Q_UNUSED(child);
+
+  return QModelIndex();
+}
+
+QModelIndex FileInfoProxy::mapToSource(const QModelIndex& proxyIndex) const
+{
+  int row { proxyIndex.row() };
+
+  if (!sourceModel() || !proxyIndex.isValid() || row >= mProxyToSource.count()) {
+    return QModelIndex();
+  }
+
+  return sourceModel()->index(mProxyToSource.at(row), 0);
+}
+
+QModelIndex FileInfoProxy::mapFromSource(const QModelIndex& sourceIndex) const
+{
+  int row { sourceIndex.row() };
+
+  if (!sourceIndex.isValid() || row >= mSourceToProxy.count() || mSourceToProxy.at(row) < 0) {
+    return QModelIndex();
+  }
+
+  return createIndex(mSourceToProxy.at(row), 0);
+}
+
+// The name, which the model keeps as it is, rules out nearly every row
+// without building its path.
+bool FileInfoProxy::filterAcceptsRow(int sourceRow) const
+{
+  if (!mIsFiltered) return true;
+
+  return mAcceptedNames.contains(fileInfoModel()->nameOf(sourceRow)) &&
+    mAcceptedPaths.contains(fileInfoModel()->filePath(sourceRow));
+}
+
+bool FileInfoProxy::lessThan(int leftRow, int rightRow) const
+{
+  const FileInfoModel* model { fileInfoModel() };
+
+  switch (mSortMode) {
+  case CreatedOrder:
+    return model->createdTime(leftRow) < model->createdTime(rightRow);
+  case TitleOrder:
+    return model->compareTitles(leftRow, rightRow) < 0;
+  case SizeOrder:
+    return model->size(leftRow) < model->size(rightRow);
+  case ModifiedOrder:
+  default:
+    return model->modifiedTime(leftRow) < model->modifiedTime(rightRow);
+  }
+}
+
+// A strict total order, ties are broken by the file name, which stays
+// with the note when the source renumbers its rows.
+bool FileInfoProxy::isBefore(int leftRow, int rightRow) const
+{
+  if (lessThan(leftRow, rightRow)) return mSortOrder == Qt::AscendingOrder;
+  if (lessThan(rightRow, leftRow)) return mSortOrder == Qt::DescendingOrder;
+
+  int names { fileInfoModel()->compareNames(leftRow, rightRow) };
+
+  return names != 0 ? names < 0 : leftRow < rightRow;
+}
+
+// Returns the proxy row in [first, last) before which sourceRow belongs.
+int FileInfoProxy::findPosition(int sourceRow, int first, int last) const
+{
+  auto begin { mProxyToSource.constBegin() };
+  auto found { std::upper_bound(begin + first, begin + last, sourceRow,
+				[this](int value, int element) { return isBefore(value, element); }) };
+
+  return found - begin;
+}
+
+void FileInfoProxy::updateSourceToProxy(int first, int last)
+{
+  for (int proxyRow { first }; proxyRow <= last; ++proxyRow) {
+    mSourceToProxy[mProxyToSource.at(proxyRow)] = proxyRow;
+  }
+}
+
+// A filtered list is built from the rows of the accepted notes, without
+// visiting the others.
+void FileInfoProxy::rebuild()
+{
+  int count { sourceModel() ? sourceModel()->rowCount() : 0 };
+  mProxyToSource.clear();
+  mSourceToProxy.fill(-1, count);
+
+  if (!mIsFiltered) {
+    mProxyToSource.reserve(count);
+
+    for (int row { 0 }; row < count; ++row) {
+      mProxyToSource.append(row);
+    }
+  } else if (count > 0) {
+    for (const auto& path : mAcceptedPaths) {
+      int row { fileInfoModel()->findRow(path) };
+
+      if (row >= 0) mProxyToSource.append(row);
+    }
+  }
+
+  std::sort(mProxyToSource.begin(), mProxyToSource.end(),
+	    [this](int left, int right) { return isBefore(left, right); });
+  updateSourceToProxy(0, mProxyToSource.count() - 1);
+}
+
+// Sorts everything again, keeping the selection of the views.
+void FileInfoProxy::relayout()
+{
+  emit layoutAboutToBeChanged();
+
+  QModelIndexList oldIndexes { persistentIndexList() };
+  QModelIndexList sourceIndexes;
+
+  for (const auto& proxyIndex : oldIndexes) {
+    sourceIndexes.append(mapToSource(proxyIndex));
+  }
+
+  rebuild();
+
+  QModelIndexList newIndexes;
+
+  for (const auto& sourceIndex : sourceIndexes) {
+    newIndexes.append(mapFromSource(sourceIndex));
+  }
+
+  changePersistentIndexList(oldIndexes, newIndexes);
+  emit layoutChanged();
+}
+
+// Inserts rows with one signal per run of rows which land side by side,
+// so a batch of older notes appended at the bottom is a single insertion.
+void FileInfoProxy::insertSourceRows(QVector<int> sourceRows)
+{
+  std::sort(sourceRows.begin(), sourceRows.end(),
+	    [this](int left, int right) { return isBefore(left, right); });
+
+  int i { 0 };
+  int from { 0 };
+
+  while (i < sourceRows.count()) {
+    int position { findPosition(sourceRows.at(i), from, mProxyToSource.count()) };
+    int next { i + 1 };
+
+    while (next < sourceRows.count() &&
+	   (position == mProxyToSource.count() || isBefore(sourceRows.at(next), mProxyToSource.at(position)))) {
+      ++next;
+    }
+
+    beginInsertRows(QModelIndex(), position, position + next - i - 1);
+    mProxyToSource.insert(position, next - i, -1);
+    std::copy(sourceRows.constBegin() + i, sourceRows.constBegin() + next, mProxyToSource.begin() + position);
+    updateSourceToProxy(position, mProxyToSource.count() - 1);
+    endInsertRows();
+
+    from = position + next - i;
+    i = next;
+  }
+}
+
+void FileInfoProxy::removeProxyRows(QVector<int> proxyRows)
+{
+  std::sort(proxyRows.begin(), proxyRows.end(), std::greater<int>());
+
+  int i { 0 };
+
+  while (i < proxyRows.count()) {
+    int last { proxyRows.at(i) };
+    int first { last };
+    int next { i + 1 };
+
+    while (next < proxyRows.count() && proxyRows.at(next) == first - 1) {
+      first = proxyRows.at(next);
+      ++next;
+    }
+
+    beginRemoveRows(QModelIndex(), first, last);
+
+    for (int proxyRow { first }; proxyRow <= last; ++proxyRow) {
+      mSourceToProxy[mProxyToSource.at(proxyRow)] = -1;
+    }
+
+    mProxyToSource.remove(first, last - first + 1);
+    updateSourceToProxy(first, mProxyToSource.count() - 1);
+    endRemoveRows();
+
+    i = next;
+  }
+}
+
+// Moves a changed row to its place, found by binary search over the rows
+// above or below it, which are still in order. Only the rows it passes
+// are renumbered.
+void FileInfoProxy::moveIntoPlace(int proxyRow)
+{
+  int row { mProxyToSource.at(proxyRow) };
+  int count { mProxyToSource.count() };
+  auto begin { mProxyToSource.begin() };
+
+  if (proxyRow > 0 && isBefore(row, mProxyToSource.at(proxyRow - 1))) {
+    int destination { findPosition(row, 0, proxyRow) };
+    beginMoveRows(QModelIndex(), proxyRow, proxyRow, QModelIndex(), destination);
+    std::rotate(begin + destination, begin + proxyRow, begin + proxyRow + 1);
+    updateSourceToProxy(destination, proxyRow);
+    endMoveRows();
+  } else if (proxyRow < count - 1 && isBefore(mProxyToSource.at(proxyRow + 1), row)) {
+    int destination { findPosition(row, proxyRow + 1, count) };
+    beginMoveRows(QModelIndex(), proxyRow, proxyRow, QModelIndex(), destination);
+    std::rotate(begin + proxyRow, begin + proxyRow + 1, begin + destination);
+    updateSourceToProxy(proxyRow, destination - 1);
+    endMoveRows();
+  }
+}
+
+void FileInfoProxy::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
+{
+  QVector<int> inserted;
+  QVector<int> removed;
+
+  for (int row { topLeft.row() }; row <= bottomRight.row(); ++row) {
+    bool isAccepted { filterAcceptsRow(row) };
+
+    if (mSourceToProxy.at(row) < 0) {
+      if (isAccepted) inserted.append(row);
+    } else if (!isAccepted) {
+      removed.append(row);
+    } else {
+      moveIntoPlace(mSourceToProxy.at(row));
+      QModelIndex proxyIndex { index(mSourceToProxy.at(row), 0) };
+      emit dataChanged(proxyIndex, proxyIndex, roles);
+    }
+  }
+
+  QVector<int> proxyRows;
+
+  for (int row : removed) {
+    proxyRows.append(mSourceToProxy.at(row));
+  }
+
+  removeProxyRows(proxyRows);
+  insertSourceRows(inserted);
+}
+
+void FileInfoProxy::onModelReset()
+{
+  beginResetModel();
+  rebuild();
+  endResetModel();
+}
+
+// The source rows are renumbered, so the views keep their selection
+// through indexes of the source, as relayout() does.
+void FileInfoProxy::onLayoutAboutToBeChanged()
+{
+  if (mIsRenumbering) return;
+
+  emit layoutAboutToBeChanged();
+
+  mLayoutIndexes = persistentIndexList();
+
+  for (const auto& proxyIndex : mLayoutIndexes) {
+    mLayoutSourceIndexes.append(mapToSource(proxyIndex));
+  }
+}
+
+void FileInfoProxy::onLayoutChanged()
+{
+  if (mIsRenumbering) {
+    mIsRenumbering = false;
+    return;
+  }
+
+  rebuild();
+
+  QModelIndexList newIndexes;
+
+  for (const auto& sourceIndex : mLayoutSourceIndexes) {
+    newIndexes.append(mapFromSource(sourceIndex));
+  }
+
+  changePersistentIndexList(mLayoutIndexes, newIndexes);
+  mLayoutIndexes.clear();
+  mLayoutSourceIndexes.clear();
+  emit layoutChanged();
+}
+
+void FileInfoProxy::onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last)
+{
+  if (parent.isValid()) return;
+
+  QVector<int> proxyRows;
+
+  for (int row { first }; row <= last; ++row) {
+    if (mSourceToProxy.at(row) >= 0) {
+      proxyRows.append(mSourceToProxy.at(row));
+    }
+  }
+
+  removeProxyRows(proxyRows);
+}
+
+void FileInfoProxy::onRowsRemoved(const QModelIndex& parent, int first, int last)
+{
+  if (parent.isValid()) return;
+
+  int count { last - first + 1 };
+  bool isTail { last == mSourceToProxy.count() - 1 };
+  mSourceToProxy.remove(first, count);
+
+  // FileInfoModel removes its last rows, which no row follows
+  if (isTail) return;
+
+  for (auto& row : mProxyToSource) {
+    if (row > last) row -= count;
+  }
+}
+
+// The layout change around a renumbering leaves the order of the proxy
+// as it is, so it is not passed on.
+void FileInfoProxy::onRowsAboutToBeRenumbered()
+{
+  mIsRenumbering = true;
+}
+
+// The notes keep their places in the proxy, only their source rows
+// change.
+void FileInfoProxy::onRowsRenumbered(const QVector<int>& rows, const QVector<int>& newRows)
+{
+  QVector<int> proxyRows;
+  proxyRows.reserve(rows.count());
+
+  for (int row : rows) {
+    proxyRows.append(mSourceToProxy.at(row));
+  }
+
+  for (int i { 0 }; i < rows.count(); ++i) {
+    mSourceToProxy[newRows.at(i)] = proxyRows.at(i);
+
+    if (proxyRows.at(i) >= 0) mProxyToSource[proxyRows.at(i)] = newRows.at(i);
+  }
+}
+
+void FileInfoProxy::onRowsInserted(const QModelIndex& parent, int first, int last)
+{
+  if (parent.isValid()) return;
+
+  int count { last - first + 1 };
+
+  // FileInfoModel appends its rows, which no row follows
+  if (first < mSourceToProxy.count()) {
+    for (auto& row : mProxyToSource) {
+      if (row >= first) row += count;
+    }
+  }
+
+  mSourceToProxy.insert(first, count, -1);
+  QVector<int> rows;
 
-  QString leftString { leftData.toString() };
-  QString rightString { rightData.toString() };
+  for (int row { first }; row <= last; ++row) {
+    if (filterAcceptsRow(row)) {
+      rows.append(row);
+    }
+  }
 
-  return QString::localeAwareCompare(leftString, rightString) < 0;
+  insertSourceRows(rows);
 }
@@ -19,23 +19,87 @@
 
 #pragma once
 
-#include <QSortFilterProxyModel>
+#include <QAbstractProxyModel>
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+#include <QVector>
 
 class FileInfoModel;
 
 
-class FileInfoProxy : public QSortFilterProxyModel
+// Keeps the notes of a FileInfoModel sorted. Unlike QSortFilterProxyModel
+// it does not sort again when a note changes, but moves that single row
+// to its new place. The place is found by binary search, and the rows
+// between the old place and the new one are renumbered, so a move costs
+// the distance it covers. The notes edited most are near the top of the
+// list, where the distance is short.
+class FileInfoProxy : public QAbstractProxyModel
 {
   Q_OBJECT
 
 public:
+  enum SortMode {
+    ModifiedOrder,
+    CreatedOrder,
+    TitleOrder,
+    SizeOrder,
+  };
+
   FileInfoProxy(QObject* parent = 0);
 
+  void addAcceptedFiles(const QSet<QString>& paths);
+  void clearFilter();
+  bool isFiltered() const;
+  void setAcceptedFiles(const QSet<QString>& paths);
   void setFileInfoModel(FileInfoModel* model);
   FileInfoModel* fileInfoModel() const;
+  void setSortMode(SortMode mode);
+  void setSourceModel(QAbstractItemModel* model) override;
+  void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+  SortMode sortMode() const;
+
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+  bool hasChildren(const QModelIndex& parent = QModelIndex()) const override;
+  QModelIndex index(int row, int column, const QModelIndex& parent = QModelIndex()) const override;
+  QModelIndex mapFromSource(const QModelIndex& sourceIndex) const override;
+  QModelIndex mapToSource(const QModelIndex& proxyIndex) const override;
+  QModelIndex parent(const QModelIndex& child) const override;
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
 
 protected:
-  bool filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const override;
-  bool lessThan(const QModelIndex &left, const QModelIndex& right) const override;
-};
+  bool filterAcceptsRow(int sourceRow) const;
+  bool lessThan(int leftRow, int rightRow) const;
 
+private slots:
+  void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles);
+  void onLayoutAboutToBeChanged();
+  void onLayoutChanged();
+  void onModelReset();
+  void onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+  void onRowsInserted(const QModelIndex& parent, int first, int last);
+  void onRowsRemoved(const QModelIndex& parent, int first, int last);
+  void onRowsAboutToBeRenumbered();
+  void onRowsRenumbered(const QVector<int>& rows, const QVector<int>& newRows);
+
+private:
+  int findPosition(int sourceRow, int first, int last) const;
+  void insertSourceRows(QVector<int> sourceRows);
+  bool isBefore(int leftRow, int rightRow) const;
+  void moveIntoPlace(int proxyRow);
+  void rebuild();
+  void relayout();
+  void removeProxyRows(QVector<int> proxyRows);
+  void updateSourceToProxy(int first, int last);
+
+  SortMode mSortMode;
+  Qt::SortOrder mSortOrder;
+  bool mIsFiltered;
+  QSet<QString> mAcceptedPaths;
+  QSet<QByteArray> mAcceptedNames; // UTF-8, matched before a path is built
+  QVector<int> mProxyToSource;
+  QVector<int> mSourceToProxy; // -1 for filtered rows
+  bool mIsRenumbering; // the layout change of the source is followed without sorting
+  QModelIndexList mLayoutIndexes;
+  QList<QPersistentModelIndex> mLayoutSourceIndexes;
+};
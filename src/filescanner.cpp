@@ -0,0 +1,112 @@
+// qMemo/filescanner.cpp - background scan of a note directory
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "filescanner.hpp"
+
+#include <QSet>
+#include <QtConcurrent>
+#include <algorithm>
+#include "notestore.hpp"
+
+
+const int FileScanner::BATCH_SIZE { 256 };
+
+struct FileScanner::PreviewReader
+{
+  const NoteStore* store;
+  QDir dir;
+
+  void operator()(IndexEntry& entry) const
+  {
+    entry.preview = store->preview(dir.filePath(entry.fileName));
+  }
+};
+
+FileScanner::FileScanner(const NoteStore* store, const QDir& dir, const FileIndex& cache, bool isIncremental, QObject* parent)
+  : QObject(parent), mStore(store), mDirectory(dir), mCache(cache), mIsIncremental(isIncremental),
+    mCanceled(0), mFuture()
+{
+  qRegisterMetaType<QVector<IndexEntry>>("QVector<IndexEntry>");
+}
+
+FileScanner::~FileScanner()
+{
+  cancel();
+  mFuture.waitForFinished();
+}
+
+void FileScanner::start()
+{
+  mFuture = QtConcurrent::run(this, &FileScanner::run);
+}
+
+void FileScanner::cancel()
+{
+  mCanceled.storeRelease(1);
+}
+
+void FileScanner::run()
+{
+  qint64 directoryModified { FileIndex::modifiedOf(mDirectory) };
+  QVector<IndexEntry> listed { mStore->list(mDirectory, &mCache) };
+
+  std::sort(listed.begin(), listed.end(),
+	    [](const IndexEntry& a, const IndexEntry& b) { return a.modified > b.modified; });
+
+  QSet<QString> removed;
+
+  if (mIsIncremental) {
+    for (const auto& entry : mCache.entries()) {
+      removed.insert(entry.fileName);
+    }
+  }
+
+  for (int first { 0 }; first < listed.count(); first += BATCH_SIZE) {
+    if (mCanceled.loadAcquire()) return;
+
+    QVector<IndexEntry> entries;
+    QVector<IndexEntry> changed;
+
+    for (const auto& entry : listed.mid(first, BATCH_SIZE)) {
+      const IndexEntry* cached { mCache.find(entry.fileName) };
+      removed.remove(entry.fileName);
+
+      if (!cached || !FileIndex::isUpToDate(*cached, entry)) {
+	changed.append(entry);
+      } else if (!mIsIncremental) {
+	entries.append(*cached);
+      }
+    }
+
+    if (!changed.isEmpty()) {
+      QtConcurrent::blockingMap(changed, PreviewReader { mStore, mDirectory });
+      entries += changed;
+    }
+
+    if (!entries.isEmpty()) {
+      emit entriesFound(entries);
+    }
+  }
+
+  if (!removed.isEmpty()) {
+    emit entriesRemoved(removed.values());
+  }
+
+  emit finished(directoryModified);
+}
@@ -0,0 +1,68 @@
+// qMemo/filescanner.hpp - background scan of a note directory
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFuture>
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+#include "fileindex.hpp"
+
+class NoteStore;
+
+
+// Lists a directory on the global thread pool and reports its notes in
+// batches, newest first. Notes found unchanged in the given index are
+// not read again. An incremental scan reports only the notes which differ
+// from the index, and those which have disappeared. The mtime of the
+// directory is taken before it is listed, so a change during the scan
+// is found by the next one.
+class FileScanner : public QObject
+{
+  Q_OBJECT
+
+public:
+  FileScanner(const NoteStore* store, const QDir& dir, const FileIndex& cache, bool isIncremental, QObject* parent = nullptr);
+  ~FileScanner();
+
+  void cancel();
+  void start();
+
+signals:
+  void entriesFound(const QVector<IndexEntry>& entries);
+  void entriesRemoved(const QStringList& fileNames);
+  void finished(qint64 directoryModified);
+
+private:
+  struct PreviewReader;
+
+  void run();
+
+  const NoteStore* mStore;
+  QDir mDirectory;
+  FileIndex mCache;
+  bool mIsIncremental;
+  QAtomicInt mCanceled;
+  QFuture<void> mFuture;
+
+  static const int BATCH_SIZE;
+};
@@ -0,0 +1,180 @@
+// qMemo/fileworker.cpp - thread which does the disk work of DataHandler
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "fileworker.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include "editjournal.hpp"
+#include "notefile.hpp"
+#include "notehistory.hpp"
+#include "notestore.hpp"
+
+
+FileWorker::FileWorker(NoteStore* store, NoteHistory* history, EditJournal* journal, QObject* parent)
+  : QObject(parent), mStore(store), mHistory(history), mJournal(journal), mPendingSaves()
+{
+  qRegisterMetaType<IndexEntry>("IndexEntry");
+  qRegisterMetaType<QVector<qint64>>("QVector<qint64>");
+}
+
+// Saves are queued here and written by a later call of flush(), so all
+// requests which arrive meanwhile can replace them. Any other request
+// flushes first, so it sees the notes as they were asked to be saved.
+void FileWorker::saveFile(const QString& path, const QString& text)
+{
+  if (mPendingSaves.isEmpty()) {
+    QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+  }
+
+  mPendingSaves.insert(path, text);
+}
+
+// All notes are written before any is reported, so a report means that
+// every save asked for before it is on the disk.
+void FileWorker::flush()
+{
+  QHash<QString, QString> saves;
+  saves.swap(mPendingSaves);
+  QHash<QString, IndexEntry> entries;
+
+  for (auto i { saves.constBegin() }; i != saves.constEnd(); ++i) {
+    IndexEntry entry {};
+
+    // a note deleted meanwhile is not brought back
+    if (mStore->exists(i.key()) && mStore->save(i.key(), i.value(), &entry)) {
+      entries.insert(i.key(), entry);
+      mHistory->record(i.key(), i.value());
+    } else {
+      qCritical("Failed to save: FileWorker::flush()");
+    }
+  }
+
+  for (auto i { saves.constBegin() }; i != saves.constEnd(); ++i) {
+    emit fileSaved(i.key(), entries.contains(i.key()), entries.value(i.key()), NoteFile::hash(i.value()));
+  }
+}
+
+void FileWorker::createFile(const QString& path, const QString& text)
+{
+  flush();
+
+  IndexEntry entry {};
+  bool isDone { mStore->save(path, text, &entry) };
+
+  if (isDone) {
+    mHistory->record(path, text);
+  } else {
+    qCritical("Failed to create: FileWorker::createFile()");
+  }
+
+  emit fileCreated(path, isDone, entry);
+}
+
+void FileWorker::loadFile(const QString& path)
+{
+  flush();
+
+  // taken before reading, so a change meanwhile makes it look older
+  qint64 modified { mStore->modified(path) };
+  emit fileLoaded(path, modified, mStore->load(path));
+}
+
+// The history is read here, so a long save never holds up the editor.
+void FileWorker::loadVersions(const QString& path)
+{
+  flush();
+  emit versionsLoaded(path, mHistory->versions(path));
+}
+
+void FileWorker::loadVersion(const QString& path, qint64 time)
+{
+  flush();
+  emit versionLoaded(path, mHistory->load(path, time));
+}
+
+void FileWorker::moveFiles(const QStringList& paths, const QStringList& newPaths)
+{
+  flush();
+
+  QVector<bool> areDone { mStore->moveAll(paths, newPaths) };
+
+  for (int i { 0 }; i < paths.count(); ++i) {
+    bool isDone { areDone.at(i) };
+
+    if (isDone) {
+      mHistory->rename(paths.at(i), newPaths.at(i));
+    } else {
+      qCritical("Failed to move: FileWorker::moveFiles()");
+    }
+
+    emit fileMoved(paths.at(i), newPaths.at(i), isDone);
+  }
+}
+
+void FileWorker::removeFiles(const QStringList& paths)
+{
+  flush();
+
+  QVector<bool> areDone { mStore->removeAll(paths) };
+
+  for (int i { 0 }; i < paths.count(); ++i) {
+    const QString& path { paths.at(i) };
+    bool isDone { areDone.at(i) };
+
+    if (isDone) {
+      mHistory->remove(path);
+    } else {
+      qCritical("Failed to delete: FileWorker::removeFiles()");
+    }
+
+    emit fileRemoved(path, isDone);
+  }
+}
+
+// Notes are written to the directory as plain files under their own
+// names, whichever store keeps them.
+void FileWorker::exportFiles(const QStringList& paths, const QString& directory)
+{
+  flush();
+
+  QDir dir { directory };
+  int exported { 0 };
+
+  for (const auto& path : paths) {
+    if (!mStore->exists(path)) continue;
+
+    QByteArray bytes { mStore->load(path).toUtf8() };
+    QSaveFile file { dir.filePath(QFileInfo(path).fileName()) };
+
+    if (file.open(QIODevice::WriteOnly | QIODevice::Text) && file.write(bytes) == bytes.size() && file.commit()) {
+      ++exported;
+    } else {
+      qCritical("Failed to export: FileWorker::exportFiles()");
+    }
+  }
+
+  emit filesExported(exported, paths.count() - exported);
+}
+
+void FileWorker::writeJournal()
+{
+  mJournal->flush();
+}
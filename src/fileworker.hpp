@@ -0,0 +1,74 @@
+// qMemo/fileworker.hpp - thread which does the disk work of DataHandler
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "fileindex.hpp"
+
+class EditJournal;
+class NoteHistory;
+class NoteStore;
+
+
+// Lives on its own thread and does all reading and writing of notes for
+// DataHandler, which calls its slots through queued connections and
+// learns the outcome from its signals. Saves of a note which pile up
+// while the disk is busy are written once, with the latest text. Every
+// written text is kept in the history of its note. Records of the edit
+// journal are written here too.
+class FileWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  FileWorker(NoteStore* store, NoteHistory* history, EditJournal* journal, QObject* parent = nullptr);
+
+public slots:
+  void createFile(const QString& path, const QString& text);
+  void exportFiles(const QStringList& paths, const QString& directory);
+  void flush();
+  void loadFile(const QString& path);
+  void loadVersion(const QString& path, qint64 time);
+  void loadVersions(const QString& path);
+  void moveFiles(const QStringList& paths, const QStringList& newPaths);
+  void removeFiles(const QStringList& paths);
+  void saveFile(const QString& path, const QString& text);
+  void writeJournal();
+
+signals:
+  void fileCreated(const QString& path, bool isDone, const IndexEntry& entry);
+  void filesExported(int exported, int failed);
+  void fileLoaded(const QString& path, qint64 modified, const QString& text);
+  void fileMoved(const QString& path, const QString& newPath, bool isDone);
+  void fileRemoved(const QString& path, bool isDone);
+  void fileSaved(const QString& path, bool isDone, const IndexEntry& entry, const QByteArray& hash);
+  void versionLoaded(const QString& path, const QString& text);
+  void versionsLoaded(const QString& path, const QVector<qint64>& times);
+
+private:
+  NoteStore* mStore;
+  NoteHistory* mHistory;
+  EditJournal* mJournal;
+  QHash<QString, QString> mPendingSaves;
+};
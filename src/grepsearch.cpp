@@ -0,0 +1,208 @@
+// qMemo/grepsearch.cpp - brute-force search over the note files
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "grepsearch.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QtAlgorithms>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include "notestore.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+const int GrepSearch::BATCH_SIZE { 512 };
+
+// Tells whether a note matches. It gives up as soon as a newer search
+// has started.
+struct GrepSearch::Matcher
+{
+  const NoteStore* store;
+  const QAtomicInt* current;
+  int generation;
+  QByteArray needle;
+  QRegularExpression regex;
+  bool isRegex;
+
+  bool operator()(const QString& path) const
+  {
+    if (current->loadAcquire() != generation) return false;
+
+    QByteArray contents;
+    const char* data { nullptr };
+    qint64 size { 0 };
+    QFile file { path };
+
+    if (store->hasNoteFiles() && file.open(QIODevice::ReadOnly)) {
+      if (file.size() == 0) return false;
+
+      size = file.size();
+      data = reinterpret_cast<const char*>(file.map(0, size));
+    }
+
+    if (!data) {
+      // the note has no file of its own, as a packed one, or its file
+      // system cannot map files
+      contents = store->read(path);
+      data = contents.constData();
+      size = contents.size();
+    }
+
+    if (isRegex) {
+      return regex.match(QString::fromUtf8(data, static_cast<int>(size))).hasMatch();
+    } else {
+      return GrepSearch::containsBytes(data, size, needle);
+    }
+  }
+};
+
+GrepSearch::GrepSearch(QObject* parent)
+  : QObject(parent), mGeneration(0), mFutures()
+{
+  qRegisterMetaType<QSet<QString>>("QSet<QString>");
+
+  // results of a dropped search may still be queued when a new one starts
+  connect(this, &GrepSearch::batchFound, this,
+	  [=](int generation, const QSet<QString>& paths) {
+	    if (generation == mGeneration.loadAcquire()) emit filesFound(paths);
+	  });
+  connect(this, &GrepSearch::batchFinished, this,
+	  [=](int generation) {
+	    if (generation == mGeneration.loadAcquire()) emit finished();
+	  });
+}
+
+GrepSearch::~GrepSearch()
+{
+  cancel();
+
+  for (auto& future : mFutures) {
+    future.waitForFinished();
+  }
+}
+
+void GrepSearch::start(const NoteStore* store, const QStringList& directories, const QString& pattern, bool isRegex)
+{
+  cancel();
+
+  for (auto i { mFutures.begin() }; i != mFutures.end(); ) {
+    i = i->isFinished() ? mFutures.erase(i) : i + 1;
+  }
+
+  mFutures.append(QtConcurrent::run(this, &GrepSearch::run, store, directories, pattern, isRegex, mGeneration.loadAcquire()));
+}
+
+void GrepSearch::cancel()
+{
+  mGeneration.fetchAndAddOrdered(1);
+}
+
+void GrepSearch::run(const NoteStore* store, const QStringList& directories, const QString& pattern, bool isRegex, int generation)
+{
+  Matcher matcher { store, &mGeneration, generation, pattern.toUtf8(), QRegularExpression(pattern), isRegex };
+
+  if (isRegex) {
+    if (!matcher.regex.isValid()) {
+      emit batchFinished(generation);
+      return;
+    }
+
+    matcher.regex.optimize();
+  }
+
+  QStringList paths;
+
+  for (const auto& directory : directories) {
+    QDir dir { directory };
+    QStringList fileNames;
+
+    for (const auto& entry : store->list(dir)) {
+      fileNames.append(entry.fileName);
+    }
+
+    // the newest notes, which are named by their creation time, come first
+    std::sort(fileNames.begin(), fileNames.end(), std::greater<QString>());
+
+    for (const auto& fileName : fileNames) {
+      paths.append(dir.filePath(fileName));
+    }
+  }
+
+  for (int first { 0 }; first < paths.count(); first += BATCH_SIZE) {
+    if (mGeneration.loadAcquire() != generation) return;
+
+    QStringList matched { paths.mid(first, BATCH_SIZE) };
+    QtConcurrent::blockingFiltered(matched, matcher);
+
+    if (!matched.isEmpty()) {
+      emit batchFound(generation, QSet<QString>::fromList(matched));
+    }
+  }
+
+  emit batchFinished(generation);
+}
+
+// Compares the first and the last byte of the needle at 16 positions at
+// once, and the rest only where both agree.
+bool GrepSearch::containsBytes(const char* data, qint64 size, const QByteArray& needle)
+{
+  const qint64 length { needle.size() };
+
+  if (length == 0) return true;
+  if (size < length) return false;
+
+  const char* p { data };
+  const char* end { data + size - length + 1 };
+  const char first { needle.at(0) };
+  const char last { needle.at(length - 1) };
+
+#ifdef __SSE2__
+  const __m128i firstBytes { _mm_set1_epi8(first) };
+  const __m128i lastBytes { _mm_set1_epi8(last) };
+
+  for (; p + 16 <= end; p += 16) {
+    __m128i head { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) };
+    __m128i tail { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + length - 1)) };
+    quint32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, firstBytes),
+						   _mm_cmpeq_epi8(tail, lastBytes)));
+
+    while (mask != 0) {
+      int offset = qCountTrailingZeroBits(mask);
+
+      if (length <= 2 || std::memcmp(p + offset + 1, needle.constData() + 1, length - 2) == 0) return true;
+
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; p < end; ++p) {
+    if (*p == first && p[length - 1] == last &&
+	std::memcmp(p, needle.constData(), length) == 0) return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,68 @@
+// qMemo/grepsearch.hpp - brute-force search over the note files
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QFuture>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class NoteStore;
+
+
+// Searches the note files themselves for a substring or a regular
+// expression, for queries which the word index cannot answer. Files are
+// mapped into memory and scanned on the global thread pool; matches are
+// reported in batches while the search runs. Starting a new search drops
+// the running one.
+class GrepSearch : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit GrepSearch(QObject* parent = nullptr);
+  ~GrepSearch();
+
+  void cancel();
+  void start(const NoteStore* store, const QStringList& directories, const QString& pattern, bool isRegex);
+
+  static bool containsBytes(const char* data, qint64 size, const QByteArray& needle);
+
+signals:
+  void filesFound(const QSet<QString>& paths);
+  void finished();
+
+  // internal, tagged with the search which found them
+  void batchFound(int generation, const QSet<QString>& paths);
+  void batchFinished(int generation);
+
+private:
+  struct Matcher;
+
+  void run(const NoteStore* store, const QStringList& directories, const QString& pattern, bool isRegex, int generation);
+
+  QAtomicInt mGeneration;
+  QList<QFuture<void>> mFutures;
+
+  static const int BATCH_SIZE;
+};
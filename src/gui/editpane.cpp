@@ -19,23 +19,33 @@
 #include "editpane.hpp"
 
 #include <QBoxLayout>
+#include <QDateTime>
+#include <QMenu>
 #include <QPlainTextEdit>
 #include <QPushButton>
+#include <QRegularExpression>
+#include <QTextCursor>
+#include <QTextDocument>
 
 
+const int EditPane::MAX_VERSIONS_IN_MENU { 50 };
+
 EditPane::EditPane()
-  : mTextEdit(new QPlainTextEdit)
+  : mTextEdit(new QPlainTextEdit), mHistoryMenu(new QMenu(this)), mIsSettingText(false)
 {
   auto selectAllButton { new QPushButton(tr("Select all")) };
   auto cutButton { new QPushButton(tr("Cut")) };
   auto copyButton { new QPushButton(tr("Copy")) };
   auto pasteButton { new QPushButton(tr("Paste")) };
+  auto historyButton { new QPushButton(tr("History")) };
+  historyButton->setMenu(mHistoryMenu);
 
   auto hbox { new QHBoxLayout };
   hbox->addWidget(selectAllButton);
   hbox->addWidget(cutButton);
   hbox->addWidget(copyButton);
   hbox->addWidget(pasteButton);
+  hbox->addWidget(historyButton);
 
   auto vbox { new QVBoxLayout };
   vbox->setSpacing(2);
@@ -50,12 +60,35 @@ EditPane::EditPane()
   connect(copyButton, SIGNAL(clicked()), mTextEdit, SLOT(copy()));
   connect(pasteButton, SIGNAL(clicked()), mTextEdit, SLOT(paste()));
 
+  // the versions are asked for each time the menu opens, and fill it
+  // once they have been read
+  connect(mHistoryMenu, &QMenu::aboutToShow,
+	  [=]() {
+	    mHistoryMenu->clear();
+	    mHistoryMenu->addAction(tr("Loading..."))->setEnabled(false);
+	    emit historyRequested();
+	  });
+  connect(mHistoryMenu, &QMenu::triggered,
+	  [=](QAction* action) { emit versionSelected(action->data().toLongLong()); });
+
   // enable buttons
   connect(this, SIGNAL(editableRequested(bool)), cutButton, SLOT(setEnabled(bool))); 
   connect(this, SIGNAL(editableRequested(bool)), pasteButton, SLOT(setEnabled(bool))); 
+  connect(this, SIGNAL(editableRequested(bool)), historyButton, SLOT(setEnabled(bool))); 
 
-  // text changed
-  connect(mTextEdit, SIGNAL(textChanged()), this, SIGNAL(textChanged()));
+  // text changed, without looking at the whole document
+  connect(mTextEdit->document(), &QTextDocument::contentsChange,
+	  [=](int position, int charsRemoved, int charsAdded) {
+	    if (mIsSettingText || (charsRemoved == 0 && charsAdded == 0)) return;
+
+	    QTextCursor cursor { mTextEdit->document() };
+	    cursor.setPosition(position);
+	    cursor.setPosition(qMin(position + charsAdded, mTextEdit->document()->characterCount() - 1),
+			       QTextCursor::KeepAnchor);
+	    emit contentsEdited(position, charsRemoved,
+				cursor.selectedText().replace(QChar::ParagraphSeparator, '\n'));
+	    emit textChanged();
+	  });
 }
 
 void EditPane::setEditable(bool b)
@@ -64,9 +97,36 @@ void EditPane::setEditable(bool b)
   emit editableRequested(b);
 }
 
+// Stops at the first visible character, instead of copying the text.
+bool EditPane::isBlank() const
+{
+  static const QRegularExpression NON_SPACE { "\\S" };
+
+  return mTextEdit->document()->find(NON_SPACE).isNull();
+}
+
+int EditPane::length() const
+{
+  return mTextEdit->document()->characterCount() - 1;
+}
+
+bool EditPane::isModified() const
+{
+  return mTextEdit->document()->isModified();
+}
+
+void EditPane::setModified(bool b)
+{
+  mTextEdit->document()->setModified(b);
+}
+
 void EditPane::setText(const QString& text)
 {
+  // a loaded note is neither an edit nor unsaved
+  mIsSettingText = true;
   mTextEdit->setPlainText(text);
+  mIsSettingText = false;
+  mTextEdit->document()->setModified(false);
   mTextEdit->moveCursor(QTextCursor::Start);
   mTextEdit->setFocus(Qt::OtherFocusReason);
 }
@@ -75,3 +135,27 @@ QString EditPane::text() const
 {
   return mTextEdit->toPlainText();
 }
+
+// The newest versions come first.
+void EditPane::setVersions(const QVector<qint64>& times)
+{
+  mHistoryMenu->clear();
+
+  for (int i { times.size() - 1 }; i >= 0 && i >= times.size() - MAX_VERSIONS_IN_MENU; --i) {
+    QAction* action { mHistoryMenu->addAction(QDateTime::fromMSecsSinceEpoch(times[i]).toString(Qt::SystemLocaleShortDate)) };
+    action->setData(times[i]);
+  }
+
+  if (times.isEmpty()) mHistoryMenu->addAction(tr("No saved versions"))->setEnabled(false);
+}
+
+// Unlike setText(), the old version replaces the text as an edit, so it
+// can be undone, and is journaled and saved like typing.
+void EditPane::restoreText(const QString& text)
+{
+  QTextCursor cursor { mTextEdit->document() };
+  cursor.select(QTextCursor::Document);
+  cursor.insertText(text);
+  mTextEdit->moveCursor(QTextCursor::Start);
+  mTextEdit->setFocus(Qt::OtherFocusReason);
+}
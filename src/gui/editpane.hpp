@@ -19,8 +19,10 @@
 
 #pragma once
 
+#include <QVector>
 #include <QWidget>
 
+class QMenu;
 class QPlainTextEdit;
 
 
@@ -31,16 +33,29 @@ class EditPane : public QWidget
 public:
   EditPane();
   
+  bool isBlank() const;
+  bool isModified() const;
+  int length() const;
+  void restoreText(const QString& text);
+  void setModified(bool b);
   void setText(const QString& text);
+  void setVersions(const QVector<qint64>& times);
   QString text() const;
 
 public slots:
   void setEditable(bool b);
 
 signals:
+  void contentsEdited(int position, int charsRemoved, const QString& inserted);
   void editableRequested(bool b);
+  void historyRequested();
   void textChanged();
+  void versionSelected(qint64 time);
 
 private:
   QPlainTextEdit* mTextEdit;
+  QMenu* mHistoryMenu;
+  bool mIsSettingText;
+
+  static const int MAX_VERSIONS_IN_MENU;
 };
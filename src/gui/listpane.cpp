@@ -18,41 +18,84 @@
 
 #include "listpane.hpp"
 
+#include <QAction>
 #include <QBoxLayout>
 #include <QComboBox>
+#include <QLineEdit>
 #include <QListView>
 #include <QPushButton>
+#include <algorithm>
 #include "../datahandler.hpp"
 #include "previewdelegate.hpp"
 
 ListPane::ListPane()
   : QWidget(),
     mListView(new QListView),
+    mSearchEdit(new QLineEdit),
+    mSearchModeBox(new QComboBox),
     mFileInfoProxy()
 {
   auto selectBox { new QComboBox };
+  auto sortBox { new QComboBox };
   auto moveButton { new QPushButton(tr("Move")) };
   auto newButton { new QPushButton(tr("New")) };
+  auto moveAction { new QAction(tr("Move"), mListView) };
+  auto deleteAction { new QAction(tr("Delete"), mListView) };
+  auto exportAction { new QAction(tr("Export..."), mListView) };
 
   // selected item changed in ComboBox
   connect(selectBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, &ListPane::selectedFileListChanged);
+  connect(sortBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, &ListPane::changeSortMode);
+
+  // search text edited
+  connect(mSearchEdit, &QLineEdit::textChanged, this, &ListPane::searchTextChanged);
+  connect(mSearchModeBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+	  [=]() { emit searchTextChanged(mSearchEdit->text()); });
 
   // button clicked
   connect(newButton, static_cast<void (QPushButton::*)(bool)>(&QPushButton::clicked), this, &ListPane::newButtonClicked);
   connect(moveButton, static_cast<void (QPushButton::*)(bool)>(&QPushButton::clicked), this, &ListPane::moveButtonClicked);
 
+  // context menu of the list, for the selected notes
+  connect(moveAction, &QAction::triggered, this, &ListPane::moveButtonClicked);
+  connect(deleteAction, &QAction::triggered, this, &ListPane::deleteRequested);
+  connect(exportAction, &QAction::triggered, this, &ListPane::exportRequested);
+
   // Enable buttons
   connect(this, &ListPane::isEditableChanged, newButton, static_cast<void (QPushButton::*)(bool)>(&QPushButton::setEnabled));
   connect(this, &ListPane::itemCounted, moveButton, static_cast<void (QPushButton::*)(bool)>(&QPushButton::setEnabled));
 
+  for (auto action : { moveAction, deleteAction, exportAction }) {
+    connect(this, &ListPane::itemCounted, action, &QAction::setEnabled);
+    mListView->addAction(action);
+  }
+
   selectBox->addItem(tr("Active"));
   selectBox->addItem(tr("Archive"));
 
+  // in the order of FileInfoProxy::SortMode
+  sortBox->addItem(tr("Modified"));
+  sortBox->addItem(tr("Created"));
+  sortBox->addItem(tr("Title"));
+  sortBox->addItem(tr("Size"));
+
+  mSearchEdit->setPlaceholderText(tr("Search"));
+  mSearchEdit->setClearButtonEnabled(true);
+
+  // in the order of SearchMode
+  mSearchModeBox->addItem(tr("Words"));
+  mSearchModeBox->addItem(tr("Text"));
+  mSearchModeBox->addItem(tr("Regex"));
+
   auto hbox { new QHBoxLayout };
   hbox->addWidget(selectBox);
+  hbox->addWidget(sortBox);
   hbox->addWidget(moveButton);
   hbox->addWidget(newButton);
 
+  auto searchBox { new QHBoxLayout };
+  searchBox->addWidget(mSearchEdit);
+  searchBox->addWidget(mSearchModeBox);
 
   prepareListView();
 
@@ -60,6 +103,7 @@ ListPane::ListPane()
   vbox->setSpacing(2);
   vbox->setMargin(2);
   vbox->addLayout(hbox);
+  vbox->addLayout(searchBox);
   vbox->addWidget(mListView);
 
   setLayout(vbox);
@@ -73,10 +117,15 @@ void ListPane::prepareListView()
   QAbstractItemDelegate* delegate { new PreviewDelegate()};
   mListView->setItemDelegate(delegate);
   
-  connect(mListView->selectionModel(), static_cast<void (QItemSelectionModel::*)(const QItemSelection&, const QItemSelection&)>(&QItemSelectionModel::selectionChanged),
-	  this, &ListPane::changeSelectedFile);
+  // several notes can be selected for a move, a deletion or an export,
+  // and the current one is edited
+  mListView->setSelectionMode(QAbstractItemView::ExtendedSelection);
+  mListView->setContextMenuPolicy(Qt::ActionsContextMenu);
+  connect(mListView->selectionModel(), &QItemSelectionModel::currentChanged, this, &ListPane::changeSelectedFile);
   
   mListView->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+  // every row has the height of PreviewDelegate::sizeHint()
+  mListView->setUniformItemSizes(true);
 
 }
 
@@ -90,25 +139,111 @@ void ListPane::setCurrentSourceIndex(int sourceIndex)
 {
   auto listModel { mFileInfoProxy.sourceModel() };
   auto indexModel { listModel->index(sourceIndex, 0)};
+
+  if (!mFileInfoProxy.mapFromSource(indexModel).isValid()) {
+    // a new note is shown even if it does not match the search
+    mFileInfoProxy.addAcceptedFiles({ mFileInfoProxy.fileInfoModel()->filePath(sourceIndex) });
+  }
+
   mListView->setCurrentIndex(mFileInfoProxy.mapFromSource(indexModel));
   emit itemCounted(true);
 }
 
+void ListPane::selectFirstItem()
+{
+  if (!mListView->currentIndex().isValid() && mFileInfoProxy.rowCount() > 0) {
+    mListView->setCurrentIndex(mFileInfoProxy.index(0, 0));
+    emit itemCounted(true);
+  }
+}
+
+ListPane::SearchMode ListPane::searchMode() const
+{
+  return static_cast<SearchMode>(mSearchModeBox->currentIndex());
+}
+
+QString ListPane::searchText() const
+{
+  return mSearchEdit->text();
+}
+
+// The selected note stays in the list while it is edited.
+void ListPane::setFilter(QSet<QString> paths)
+{
+  QModelIndex current { mFileInfoProxy.mapToSource(mListView->currentIndex()) };
+
+  if (current.isValid()) {
+    paths.insert(mFileInfoProxy.fileInfoModel()->filePath(current.row()));
+  }
+
+  mFileInfoProxy.setAcceptedFiles(paths);
+  mListView->scrollTo(mListView->currentIndex());
+  checkCount();
+}
+
+// Matches of a running search are shown as they come in.
+void ListPane::addFilteredFiles(const QSet<QString>& paths)
+{
+  mFileInfoProxy.addAcceptedFiles(paths);
+  checkCount();
+}
+
+void ListPane::clearFilter()
+{
+  mFileInfoProxy.clearFilter();
+  mListView->scrollTo(mListView->currentIndex());
+  checkCount();
+}
+
+void ListPane::changeSortMode(int index)
+{
+  mFileInfoProxy.setSortMode(static_cast<FileInfoProxy::SortMode>(index));
+  mListView->scrollTo(mListView->currentIndex());
+}
+
+// The selected notes, in the order of the list.
+QList<QUrl> ListPane::selectedFiles() const
+{
+  QModelIndexList indexes { mListView->selectionModel()->selectedRows() };
+  std::sort(indexes.begin(), indexes.end());
+  QList<QUrl> files;
+
+  for (const auto& index : indexes) {
+    files.append(index.data(FileInfoModel::FileURLRole).toUrl());
+  }
+
+  return files;
+}
+
 int ListPane::currentSourceIndex() const
 {
   QModelIndexList indexes { mListView->selectionModel()->currentIndex() };
   return mFileInfoProxy.mapToSource(indexes[0]).row();
 }
 
-void ListPane::changeSelectedFile(const QItemSelection& selected, const QItemSelection& deselected)
+bool ListPane::isCurrentSelected() const
 {
-  Q_UNUSED(deselected);
-  
-  QModelIndexList indexes { selected.indexes() };
+  return mListView->selectionModel()->isSelected(mListView->currentIndex());
+}
+
+void ListPane::changeSelectedFile(const QModelIndex& current, const QModelIndex& previous)
+{
+  Q_UNUSED(previous);
   
-  if (!indexes.isEmpty()) {
-    emit selectedFileChanged(mFileInfoProxy.mapToSource(indexes[0]).row());
+  if (!current.isValid()) return;
+
+  emit selectedFileChanged(mFileInfoProxy.mapToSource(current).row());
+
+  // after the selected note, so that it is read first
+  QList<int> neighbours;
+
+  for (int row : { current.row() - 1, current.row() + 1 }) {
+    if (row >= 0 && row < mFileInfoProxy.rowCount()) {
+      neighbours.append(mFileInfoProxy.mapToSource(mFileInfoProxy.index(row, 0)).row());
+    }
   }
+
+  emit neighboursSelected(neighbours);
 }
 
 bool ListPane::checkCount()
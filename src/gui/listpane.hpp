@@ -19,12 +19,15 @@
 
 #pragma once
 
+#include <QList>
+#include <QUrl>
 #include <QWidget>
 #include "../fileinfoproxy.hpp"
 
 class DataHandler;
 class QAbstractItemModel;
-class QItemSelection;
+class QComboBox;
+class QLineEdit;
 class QListView;
 
 
@@ -33,21 +36,36 @@ class ListPane : public QWidget
   Q_OBJECT
   
 public:
+  enum SearchMode { WordSearch, TextSearch, PatternSearch };
+
   explicit ListPane();
   
   bool checkCount();
+  void clearFilter();
   int currentSourceIndex() const;
+  bool isCurrentSelected() const;
+  SearchMode searchMode() const;
+  QString searchText() const;
+  QList<QUrl> selectedFiles() const;
+  void selectFirstItem();
   void setCurrentSourceIndex(int sourceIndex);
+  void setFilter(QSet<QString> paths);
 
 public slots:
-  void changeSelectedFile(const QItemSelection& selected, const QItemSelection& deselected);
+  void addFilteredFiles(const QSet<QString>& paths);
+  void changeSelectedFile(const QModelIndex& current, const QModelIndex& previous);
+  void changeSortMode(int index);
   void setFileList(QAbstractItemModel* model);
   
 signals:
+  void deleteRequested();
+  void exportRequested();
   void isEditableChanged(bool editable);
   void itemCounted(bool exists);
   void moveButtonClicked(bool checked);
+  void neighboursSelected(const QList<int>& sourceIndexes);
   void newButtonClicked(bool checked);
+  void searchTextChanged(const QString& text);
   void selectedFileListChanged(int index);
   void selectedFileChanged(int sourceIndex);
 
@@ -55,5 +73,7 @@ private:
   void prepareListView();
 
   QListView* mListView;
+  QLineEdit* mSearchEdit;
+  QComboBox* mSearchModeBox;
   FileInfoProxy mFileInfoProxy;
 };
@@ -20,6 +20,8 @@
 #include "mainwindow.hpp"
 
 #include <QBoxLayout>
+#include <QFileDialog>
+#include <QMessageBox>
 #include <QPushButton>
 #include <QPlainTextEdit>
 #include <QTimer>
@@ -28,13 +30,20 @@
 #include "listpane.hpp"
 
 
+const int MainWindow::SAVE_DELAY { 2000 };
+const int MainWindow::MAX_SAVE_DELAY { 10000 };
+const int MainWindow::LARGE_NOTE_LENGTH { 1 << 20 };
+const int MainWindow::LARGE_SAVE_DELAY { 10000 };
+const int MainWindow::LARGE_MAX_SAVE_DELAY { 60000 };
+
+
 MainWindow::MainWindow(DataHandler* dataHandler)
   : QMainWindow(),
     mListPane(new ListPane),
     mEditPane(new EditPane),
     mDataHandler(dataHandler),
-    mTextChanged(false),
-    mReadyToSave(false)
+    mSaveTimer(new QTimer(this)),
+    mLatencyTimer(new QTimer(this))
 {
   prepareConnection(dataHandler);
 
@@ -57,22 +66,43 @@ MainWindow::MainWindow(DataHandler* dataHandler)
   setWindowTitle(tr("qMemo"));
   setVisible(true);
 
-  auto timer { new QTimer(this) };
-  connect(timer, SIGNAL(timeout()), this, SLOT(autoSave()));
-  timer->start(2000);
+  // saved once typing pauses, but not later than MAX_SAVE_DELAY after
+  // the first unsaved change
+  mSaveTimer->setSingleShot(true);
+  mLatencyTimer->setSingleShot(true);
+  connect(mSaveTimer, &QTimer::timeout, this, &MainWindow::autoSave);
+  connect(mLatencyTimer, &QTimer::timeout, this, &MainWindow::autoSave);
 }
 
 void MainWindow::prepareConnection(DataHandler* dataHandler)
 {
   connect(dataHandler, &DataHandler::fileListSwitched, mListPane, &ListPane::setFileList);
+  connect(dataHandler, &DataHandler::filesFound, this, &MainWindow::selectFirstFile);
+  connect(dataHandler, &DataHandler::fileLoaded, this, &MainWindow::showFile);
   connect(dataHandler, SIGNAL(isEditableChanged(bool)), mListPane, SIGNAL(isEditableChanged(bool)));
   connect(dataHandler, &DataHandler::isEditableChanged, mEditPane, &EditPane::setEditable);
   connect(mListPane, &ListPane::selectedFileChanged, this, &MainWindow::changeFile);
   connect(mListPane, &ListPane::selectedFileListChanged, this, &MainWindow::changeFileList);
   connect(mListPane, &ListPane::newButtonClicked, this, &MainWindow::createNewFile);
   connect(mListPane, &ListPane::moveButtonClicked, this, &MainWindow::moveCurrentFile);
-  connect(mEditPane, &EditPane::textChanged, [=]() { mTextChanged = true; } );
-
+  connect(mListPane, &ListPane::deleteRequested, this, &MainWindow::deleteSelectedFiles);
+  connect(mListPane, &ListPane::exportRequested, this, &MainWindow::exportSelectedFiles);
+  connect(mListPane, &ListPane::neighboursSelected, dataHandler, &DataHandler::prefetchFiles);
+  connect(mListPane, &ListPane::searchTextChanged, this, &MainWindow::search);
+  connect(dataHandler, &DataHandler::searchIndexChanged,
+	  [=]() { if (mListPane->searchMode() == ListPane::WordSearch) search(mListPane->searchText()); });
+  connect(dataHandler, &DataHandler::filesMatched, mListPane, &ListPane::addFilteredFiles);
+  connect(dataHandler, &DataHandler::filesExported,
+	  [=](int exported, int failed) {
+	    if (failed > 0) QMessageBox::warning(this, tr("Export"), tr("%n note(s) could not be exported.", "", failed));
+	    qInfo("Exported %d notes: MainWindow::prepareConnection()", exported);
+	  });
+  connect(mEditPane, &EditPane::textChanged, this, &MainWindow::scheduleAutoSave);
+  connect(mEditPane, &EditPane::contentsEdited, dataHandler, &DataHandler::recordEdit);
+  connect(mEditPane, &EditPane::historyRequested, dataHandler, &DataHandler::requestVersions);
+  connect(dataHandler, &DataHandler::versionsLoaded, mEditPane, &EditPane::setVersions);
+  connect(mEditPane, &EditPane::versionSelected, this, &MainWindow::restoreVersion);
+  connect(dataHandler, &DataHandler::versionLoaded, this, &MainWindow::applyVersion);
 }
 
 void MainWindow::resizeEvent(QResizeEvent* event)
@@ -83,11 +113,11 @@ void MainWindow::resizeEvent(QResizeEvent* event)
 
 void MainWindow::closeEvent(QCloseEvent* event)
 {
-  if (mDataHandler->isEditable()) {
+  if (mDataHandler->isEditable() && !mDataHandler->isLoading()) {
     if (mDataHandler->hasCurrentFile()) {
-      if (mEditPane->text().trimmed().isEmpty()) {
+      if (mEditPane->isBlank()) {
 	mDataHandler->deleteEmptyFile();
-      } else if (mTextChanged) {
+      } else if (mEditPane->isModified()) {
 	mDataHandler->saveCurrentFile(mEditPane->text());
       }
     } else {
@@ -95,23 +125,38 @@ void MainWindow::closeEvent(QCloseEvent* event)
     }
   }
 
+  mDataHandler->flush();
   event->accept();
 }
 
 void MainWindow::changeFile(int sourceIndex)
 {
-  if (mDataHandler->isEditable() && mDataHandler->hasCurrentFile()) {
-    if (mEditPane->text().trimmed().isEmpty()) {
+  if (mDataHandler->isEditable() && mDataHandler->hasCurrentFile() && !mDataHandler->isLoading()) {
+    if (mEditPane->isBlank()) {
       int previousIndex { mDataHandler->deleteEmptyFile() };
-      if (sourceIndex > previousIndex) --sourceIndex;
-    } else if (mTextChanged) {
+      // the last row takes the place of a removed one
+      if (sourceIndex == mDataHandler->fileCount()) sourceIndex = previousIndex;
+    } else if (mEditPane->isModified()) {
       mDataHandler->saveAndCloseCurrentFile(mEditPane->text());
     }
   }
 
   mDataHandler->selectFile(sourceIndex);
-  mEditPane->setText(mDataHandler->loadCurrentFile());
-  mTextChanged = mReadyToSave = false;
+  mEditPane->setText("");
+  markSaved();
+
+  if (mDataHandler->hasCurrentFile()) {
+    // nothing is typed into the note until it is there
+    mEditPane->setEditable(false);
+    mDataHandler->loadCurrentFile();
+  }
+}
+
+void MainWindow::showFile(const QString& text)
+{
+  mEditPane->setText(text);
+  mEditPane->setEditable(mDataHandler->isEditable());
+  markSaved();
 }
 
 void MainWindow::changeFileList(int index)
@@ -119,9 +164,9 @@ void MainWindow::changeFileList(int index)
   if (index == 0) {
     mDataHandler->setActiveMode(true);
   } else {
-    if (mEditPane->text().trimmed().isEmpty()) {
+    if (mEditPane->isBlank()) {
       mDataHandler->deleteEmptyFile();
-    } else if (mTextChanged) {
+    } else if (mEditPane->isModified()) {
       mDataHandler->saveAndCloseCurrentFile(mEditPane->text());
     }
 
@@ -133,66 +178,179 @@ void MainWindow::changeFileList(int index)
 		
 void MainWindow::createNewFile()
 {
-  if (mEditPane->text().isEmpty() && mDataHandler->hasCurrentFile()) return;
+  if (mEditPane->isBlank() && mDataHandler->hasCurrentFile()) return;
   
   int sourceIndex { mDataHandler->createNewFile("") };
 
   if (sourceIndex < 0) {
     qCritical("Failed to create a new file: MainWindow::createNewFile()");
   } else {
-    mTextChanged = mReadyToSave = false;
+    markSaved();
     mListPane->setCurrentSourceIndex(sourceIndex);
   }
 }
 
 void MainWindow::moveCurrentFile()
 {
-  if (mDataHandler->isEditable() && mEditPane->text().isEmpty()) return;
+  QList<QUrl> files { mListPane->selectedFiles() };
 
-  if (mTextChanged) mDataHandler->saveAndCloseCurrentFile(mEditPane->text());
+  if (files.count() > 1 || (files.count() == 1 && !mListPane->isCurrentSelected())) {
+    if (mListPane->isCurrentSelected()) closeCurrentFile();
+
+    mDataHandler->moveFiles(files);
+    checkItemCount();
+    return;
+  }
+
+  if (mDataHandler->isEditable() && mEditPane->isBlank()) return;
+
+  if (mEditPane->isModified()) mDataHandler->saveAndCloseCurrentFile(mEditPane->text());
 
   mEditPane->setText("");
-  mTextChanged = mReadyToSave = false;
+  markSaved();
   mDataHandler->moveCurrentFile(mListPane->currentSourceIndex());
   checkItemCount();
 }
 
+// The version is read on the file thread and arrives in applyVersion().
+void MainWindow::restoreVersion(qint64 time)
+{
+  if (!mDataHandler->isEditable() || mDataHandler->isLoading()) return;
+
+  mDataHandler->loadVersion(time);
+}
+
+void MainWindow::applyVersion(const QString& text)
+{
+  if (!mDataHandler->isEditable() || mDataHandler->isLoading()) return;
+
+  if (text.isNull()) {
+    qCritical("Failed to load the version: MainWindow::applyVersion()");
+    return;
+  }
+
+  mEditPane->restoreText(text);
+}
+
+void MainWindow::deleteSelectedFiles()
+{
+  QList<QUrl> files { mListPane->selectedFiles() };
+
+  if (files.isEmpty() ||
+      QMessageBox::question(this, tr("Delete"), tr("Delete %n note(s)?", "", files.count())) != QMessageBox::Yes) return;
+
+  if (mListPane->isCurrentSelected()) closeCurrentFile();
+
+  mDataHandler->removeFiles(files);
+  checkItemCount();
+}
+
+// Notes are read for the export as they are saved, so the one being
+// edited is saved first.
+void MainWindow::exportSelectedFiles()
+{
+  QList<QUrl> files { mListPane->selectedFiles() };
+
+  if (files.isEmpty()) return;
+
+  QString directory { QFileDialog::getExistingDirectory(this, tr("Export")) };
+
+  if (directory.isEmpty()) return;
+
+  autoSave();
+  mDataHandler->exportFiles(files, directory);
+}
+
+// The note being edited is saved and let go before it leaves the list.
+void MainWindow::closeCurrentFile()
+{
+  if (mDataHandler->isEditable() && !mDataHandler->isLoading() && mEditPane->isModified()) {
+    if (mDataHandler->hasCurrentFile()) {
+      mDataHandler->saveCurrentFile(mEditPane->text());
+    } else if (!mEditPane->isBlank()) {
+      mDataHandler->createNewFile(mEditPane->text());
+    }
+  }
+
+  mDataHandler->releaseCurrentFile();
+  mEditPane->setText("");
+  markSaved();
+}
+
+void MainWindow::search(const QString& text)
+{
+  mDataHandler->cancelGrep();
+
+  if (text.trimmed().isEmpty()) {
+    mListPane->clearFilter();
+  } else if (mListPane->searchMode() == ListPane::WordSearch) {
+    mListPane->setFilter(mDataHandler->search(text));
+  } else {
+    // files are read again on every keystroke, so matches arrive later
+    mListPane->setFilter(QSet<QString>());
+    mDataHandler->grep(text, mListPane->searchMode() == ListPane::PatternSearch);
+  }
+}
+
+void MainWindow::selectFirstFile()
+{
+  // the list is filled in the background, so select its top when it
+  // appears unless a new note has been started meanwhile
+  if (!mDataHandler->hasCurrentFile() && !mEditPane->isModified() && mEditPane->isBlank()) {
+    mListPane->selectFirstItem();
+  }
+}
+
 void MainWindow::checkItemCount()
 {
   if (!mListPane->checkCount()) {
     mDataHandler->releaseCurrentFile(); // release before text clear
     mEditPane->setText("");
-    mTextChanged = mReadyToSave = false;
+    markSaved();
   }
 }
 
+// Every edit is journaled, so a large note, whose save takes a while,
+// can wait longer without risking the edits.
+void MainWindow::scheduleAutoSave()
+{
+  bool isLarge { mEditPane->length() >= LARGE_NOTE_LENGTH };
+  mSaveTimer->start(isLarge ? LARGE_SAVE_DELAY : SAVE_DELAY);
+
+  if (!mLatencyTimer->isActive()) {
+    mLatencyTimer->start(isLarge ? LARGE_MAX_SAVE_DELAY : MAX_SAVE_DELAY);
+  }
+}
+
+void MainWindow::markSaved()
+{
+  mEditPane->setModified(false);
+  mSaveTimer->stop();
+  mLatencyTimer->stop();
+}
+
+// The text is taken from the editor once, only when there is something
+// to save.
 void MainWindow::autoSave()
 {
-  if (mDataHandler->isEditable()) {
-    if (mTextChanged) {
-      if (mReadyToSave) {
-	if (mDataHandler->hasCurrentFile()) {
-	  if (mDataHandler->saveCurrentFile(mEditPane->text())) {
-	    mTextChanged = mReadyToSave = false;
-	    qInfo("Saved automatically: MainWindow::autoSave()");
-	  } else {
-	    qCritical("Failed to save file: MainWindow::autoSave()");
-	    return; // do nothing if failed
-	  }
-	} else {
-	  int sourceIndex { mDataHandler->createNewFile(mEditPane->text()) };
-
-	  if (sourceIndex < 0) {
-	    qCritical("Failed to create a new file: MainWindow::autoSave()");
-	  } else {
-	    mTextChanged = mReadyToSave = false;
-	    mListPane->setCurrentSourceIndex(sourceIndex);
-	    qInfo("Created a new file: MainWindow::autoSave()");
-	  }
-	}
-      }
+  if (!mDataHandler->isEditable() || mDataHandler->isLoading() || !mEditPane->isModified()) return;
+
+  if (mDataHandler->hasCurrentFile()) {
+    if (mDataHandler->saveCurrentFile(mEditPane->text())) {
+      markSaved();
+      qInfo("Saved automatically: MainWindow::autoSave()");
+    } else {
+      qCritical("Failed to save file: MainWindow::autoSave()");
+    }
+  } else if (!mEditPane->isBlank()) {
+    int sourceIndex { mDataHandler->createNewFile(mEditPane->text()) };
+
+    if (sourceIndex < 0) {
+      qCritical("Failed to create a new file: MainWindow::autoSave()");
+    } else {
+      markSaved();
+      mListPane->setCurrentSourceIndex(sourceIndex);
+      qInfo("Created a new file: MainWindow::autoSave()");
     }
-    
-    mReadyToSave = mTextChanged;
   }
 }
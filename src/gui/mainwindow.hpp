@@ -25,6 +25,7 @@ class DataHandler;
 class EditPane;
 class ListPane;
 class QBoxLayout;
+class QTimer;
 
 
 class MainWindow : public QMainWindow
@@ -35,22 +36,38 @@ public:
   MainWindow(DataHandler* dataHandler);
 
 public slots:
+  void applyVersion(const QString& text);
   void autoSave();
   void changeFile(int sourceIndex);
   void changeFileList(int index);
   void createNewFile();
+  void deleteSelectedFiles();
+  void exportSelectedFiles();
   void moveCurrentFile();
+  void restoreVersion(qint64 time);
+  void scheduleAutoSave();
+  void search(const QString& text);
+  void selectFirstFile();
+  void showFile(const QString& text);
 
 private:
   void closeEvent(QCloseEvent* event) override;
   void resizeEvent(QResizeEvent* event) override;
 
   void checkItemCount();
+  void closeCurrentFile();
+  void markSaved();
   void prepareConnection(DataHandler* dataHandler);
 
   ListPane* mListPane;
   EditPane* mEditPane;
   DataHandler* mDataHandler;
-  bool mTextChanged;
-  bool mReadyToSave;
+  QTimer* mSaveTimer;
+  QTimer* mLatencyTimer;
+
+  static const int SAVE_DELAY;
+  static const int MAX_SAVE_DELAY;
+  static const int LARGE_NOTE_LENGTH;
+  static const int LARGE_SAVE_DELAY;
+  static const int LARGE_MAX_SAVE_DELAY;
 };
@@ -21,29 +21,82 @@
 
 #include <QFontMetrics>
 #include <QLabel>
+#include <QPixmapCache>
 #include <QTextEdit>
 #include <QTextLayout>
 #include <QtWidgets>
 #include "../fileinfomodel.hpp"
 
 
-void PreviewDelegate::paint(QPainter* painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
-  Q_UNUSED(index);
-
-  static const int fontSize { 10 };
-  static const int lineHeight { 16 };
+// pixmaps of rows which have been dropped by QPixmapCache are forgotten
+// once this many are kept
+const int PreviewDelegate::MAX_PIXMAP_KEYS { 4096 };
 
+// Rows are rendered once into pixmaps kept in QPixmapCache, keyed by the
+// version of the row, which is unique across models, so scrolling only
+// draws pixmaps. An edited note gets a new version, and a resized list
+// drops all pixmaps, as every row has the width of the list.
+void PreviewDelegate::paint(QPainter* painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
   if (option.state & QStyle::State_Selected) {
     painter->fillRect(option.rect, option.palette.highlight());
   }
 
+  qreal ratio { painter->device()->devicePixelRatioF() };
+  quint32 version { index.data(FileInfoModel::VersionRole).toUInt() };
+
+  if (option.rect.width() != mWidth || ratio != mRatio) {
+    clearPixmaps();
+    mWidth = option.rect.width();
+    mRatio = ratio;
+  }
+
+  auto found { mPixmapKeys.constFind(version) };
+  QPixmap pixmap;
+
+  if (found == mPixmapKeys.constEnd() || !QPixmapCache::find(found.value(), &pixmap)) {
+    pixmap = QPixmap(option.rect.size() * ratio);
+    pixmap.setDevicePixelRatio(ratio);
+    pixmap.fill(Qt::transparent);
+
+    QPainter rowPainter { &pixmap };
+    paintRow(&rowPainter, QRect(QPoint(0, 0), option.rect.size()), index);
+    rowPainter.end();
+
+    if (mPixmapKeys.count() >= MAX_PIXMAP_KEYS) {
+      for (auto it { mPixmapKeys.begin() }; it != mPixmapKeys.end();) {
+	it = it.value().isValid() ? it + 1 : mPixmapKeys.erase(it);
+      }
+
+      if (mPixmapKeys.count() >= MAX_PIXMAP_KEYS) clearPixmaps();
+    }
+
+    mPixmapKeys.insert(version, QPixmapCache::insert(pixmap));
+  }
+
+  painter->drawPixmap(option.rect.topLeft(), pixmap);
+}
+
+void PreviewDelegate::clearPixmaps() const {
+  for (const auto& key : mPixmapKeys) {
+    QPixmapCache::remove(key);
+  }
+
+  mPixmapKeys.clear();
+}
+
+void PreviewDelegate::paintRow(QPainter* painter, const QRect& rect, const QModelIndex &index) const {
+  static const int fontSize { 10 };
+  static const int lineHeight { 16 };
+  static const QFont modifiedFont { QFont("Arial", fontSize, QFont::Bold) };
+  static const QFont previewFont { QFont("Arial", fontSize) };
+  static const QFontMetrics fontMetrics { previewFont };
+
   painter->setPen(Qt::black);
 
   // draw modified
-  QRectF modifiedRect { option.rect };
+  QRectF modifiedRect { rect };
   modifiedRect.setHeight(lineHeight);
 
-  QFont modifiedFont { QFont("Arial", fontSize, QFont::Bold) };
   painter->setFont(modifiedFont);
 
   painter->drawText(modifiedRect,
@@ -51,12 +104,10 @@ void PreviewDelegate::paint(QPainter* painter, const QStyleOptionViewItem &optio
 		    index.data(FileInfoModel::ModifiedRole).toString());
 
   // draw preview
-  QRectF previewRect { option.rect };
+  QRectF previewRect { rect };
   previewRect.setTop(modifiedRect.bottom());
   previewRect.setHeight(2 * lineHeight);
 
-  QFont previewFont { QFont("Arial", fontSize) };
-  QFontMetrics fontMetrics { previewFont };
   QString previewText { index.data(FileInfoModel::PreviewRole).toString() };
   QTextLayout previewLayout { previewText, previewFont };
   previewLayout.beginLayout();
@@ -75,6 +126,8 @@ void PreviewDelegate::paint(QPainter* painter, const QStyleOptionViewItem &optio
 			
     }
   }
+
+  previewLayout.endLayout();
 }
 
 QSize PreviewDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const {
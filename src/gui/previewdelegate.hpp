@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <QHash>
+#include <QPixmapCache>
 #include <QStyledItemDelegate>
 
 
@@ -26,7 +28,7 @@ class PreviewDelegate : public QStyledItemDelegate {
     Q_OBJECT
 
 public:
-    PreviewDelegate(QWidget* parent = 0) : QStyledItemDelegate(parent) {}
+    PreviewDelegate(QWidget* parent = 0) : QStyledItemDelegate(parent), mPixmapKeys(), mWidth(0), mRatio(0) {}
 
     void paint(QPainter* painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
     QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
@@ -34,6 +36,16 @@ public:
     void setEditorData(QWidget* editor, const QModelIndex &index) const override; void setModelData(QWidget* editor, QAbstractItemModel* model,
                       const QModelIndex &index) const override;
 
+private:
+    void clearPixmaps() const;
+    void paintRow(QPainter* painter, const QRect& rect, const QModelIndex &index) const;
+
+    mutable QHash<quint32, QPixmapCache::Key> mPixmapKeys; // by version
+    mutable int mWidth;
+    mutable qreal mRatio;
+
+    static const int MAX_PIXMAP_KEYS;
+
 private slots:
     void commitAndCloseEditor();
 };
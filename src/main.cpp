@@ -17,9 +17,11 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QTranslator>
 
 #include "datahandler.hpp"
+#include "notestore.hpp"
 #include "gui/mainwindow.hpp"
 
 int main(int argc, char **argv)
@@ -32,7 +34,33 @@ int main(int argc, char **argv)
     // translator.load(":i18n/qmemo_hu");
     app.installTranslator(&translator);
 
-    DataHandler dataHandler;
+    QCommandLineParser parser;
+    // the store in use is kept when none is given
+    QCommandLineOption storeOption { "store",
+	QCoreApplication::translate("main", "Keeps the notes in a store of <type>, directory or packed. "
+				    "Choosing directory again writes packed notes back to files."),
+	"type" };
+    // archived notes are packed as in the last session when neither is given
+    QCommandLineOption archiveOption { "archive-packs",
+	QCoreApplication::translate("main", "Keeps archived notes in compressed packs, one for each month.") };
+    QCommandLineOption noArchiveOption { "no-archive-packs",
+	QCoreApplication::translate("main", "Writes packed archived notes back to files.") };
+    parser.addHelpOption();
+    parser.addOption(storeOption);
+    parser.addOption(archiveOption);
+    parser.addOption(noArchiveOption);
+    parser.process(app);
+
+    if (parser.isSet(storeOption) && !NoteStore::types().contains(parser.value(storeOption))) {
+        parser.showHelp(1);
+    }
+
+    DataHandler::ArchivePacking archivePacking {
+      parser.isSet(archiveOption) ? DataHandler::StartPacking :
+      parser.isSet(noArchiveOption) ? DataHandler::StopPacking :
+      DataHandler::KeepPacking
+    };
+    DataHandler dataHandler { parser.value(storeOption), archivePacking };
 
     MainWindow window { &dataHandler };
     window.show();
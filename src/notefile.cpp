@@ -0,0 +1,237 @@
+// qMemo/notefile.cpp - reading of note files
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "notefile.hpp"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+const int NoteFile::MAX_LENGTH_OF_PREVIEW { 300 };
+const int NoteFile::PREVIEW_BYTES { 4096 };
+
+// Only the head of the note is read, in one call, so a preview costs the
+// same for any size of note.
+QByteArray NoteFile::preview(const QString& path)
+{
+  QFile file { path };
+  char buffer[PREVIEW_BYTES];
+
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) return QByteArray();
+
+  qint64 size { file.read(buffer, PREVIEW_BYTES) };
+
+  return size > 0 ? previewOf(buffer, static_cast<int>(size)) : QByteArray();
+}
+
+// Runs of spaces, tabs and line ends become a single space. The preview
+// stays in UTF-8, cut after MAX_LENGTH_OF_PREVIEW characters.
+QByteArray NoteFile::previewOf(const char* data, int size)
+{
+  char collapsed[PREVIEW_BYTES];
+  int length { completeLength(collapsed, collapseSpaces(data, qMin(size, PREVIEW_BYTES), collapsed)) };
+  int characters { 0 };
+
+  for (int i { 0 }; i < length; ++i) {
+    // every byte but a continuation byte starts a character
+    if ((static_cast<unsigned char>(collapsed[i]) & 0xc0) != 0x80 && characters++ == MAX_LENGTH_OF_PREVIEW) {
+      length = i;
+      break;
+    }
+  }
+
+  return QByteArray(collapsed, length);
+}
+
+// Control characters count as spaces; leading and trailing ones are
+// dropped. Blocks of 16 bytes without any are copied at once.
+int NoteFile::collapseSpaces(const char* data, int size, char* out)
+{
+  int length { 0 };
+  bool isAfterSpace { true };
+  int i { 0 };
+
+#ifdef __SSE2__
+  const __m128i spaces { _mm_set1_epi8(' ') };
+
+  while (i + 16 <= size) {
+    __m128i block { _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)) };
+    // bytes up to ' ', compared without sign
+    int mask { _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(block, spaces), block)) };
+
+    if (mask == 0) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + length), block);
+      length += 16;
+      i += 16;
+      isAfterSpace = false;
+      continue;
+    }
+
+    for (int end { i + 16 }; i < end; ++i) {
+      if (static_cast<unsigned char>(data[i]) > ' ') {
+	out[length++] = data[i];
+	isAfterSpace = false;
+      } else if (!isAfterSpace) {
+	out[length++] = ' ';
+	isAfterSpace = true;
+      }
+    }
+  }
+#endif
+
+  for (; i < size; ++i) {
+    if (static_cast<unsigned char>(data[i]) > ' ') {
+      out[length++] = data[i];
+      isAfterSpace = false;
+    } else if (!isAfterSpace) {
+      out[length++] = ' ';
+      isAfterSpace = true;
+    }
+  }
+
+  return isAfterSpace && length > 0 ? length - 1 : length;
+}
+
+// Drops a UTF-8 sequence cut off by the end of the window.
+int NoteFile::completeLength(const char* data, int size)
+{
+  int lead { size - 1 };
+
+  while (lead >= 0 && size - lead <= 4 && (static_cast<unsigned char>(data[lead]) & 0xc0) == 0x80) {
+    --lead;
+  }
+
+  if (lead < 0) return size;
+
+  unsigned char c { static_cast<unsigned char>(data[lead]) };
+  int expected { c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1 };
+
+  return size - lead < expected ? lead : size;
+}
+
+// Identifies a text without keeping it.
+QByteArray NoteFile::hash(const QString& text)
+{
+  return QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Md5);
+}
+
+// The file is mapped and decoded in one pass. A file larger than a Qt
+// container can hold is not loaded rather than cut.
+QString NoteFile::load(const QString& path)
+{
+  QFile file { path };
+
+  if (!file.open(QIODevice::ReadOnly)) {
+    qCritical("File wasn't loaded: NoteFile::load()");
+    return QString();
+  }
+
+  qint64 size { file.size() };
+
+  if (size == 0) return QString();
+
+  if (size > std::numeric_limits<int>::max()) {
+    qCritical("File is too large to load: NoteFile::load()");
+    return QString();
+  }
+
+  const char* data { reinterpret_cast<const char*>(file.map(0, size)) };
+  QByteArray contents;
+
+  if (!data) {
+    // some file systems cannot map files
+    contents = file.readAll();
+    data = contents.constData();
+    size = contents.size();
+  }
+
+  return decode(data, static_cast<int>(size));
+}
+
+// Decodes UTF-8 text, with line ends turned into \n as text mode reading
+// did, for notes from any store.
+QString NoteFile::decode(const char* data, int size)
+{
+  QString text { QString::fromUtf8(data, size) };
+
+  if (std::memchr(data, '\r', static_cast<size_t>(size))) {
+    text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+  }
+
+  return text;
+}
+
+// The note is written to a temporary file which replaces it on commit, so
+// a crash never leaves it half written. The entry of the note is made
+// from the text and the written file, which renaming does not change, so
+// the note need not be read again.
+bool NoteFile::save(const QString& path, const QString& text, IndexEntry* entry)
+{
+  QByteArray bytes { text.toUtf8() };
+  QSaveFile file { path };
+
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text) ||
+      file.write(bytes) != bytes.size() ||
+      !file.flush()) return false;
+
+  if (entry) {
+    entry->fileName = QFileInfo(path).fileName();
+    entry->size = file.size();
+    entry->modified = file.fileTime(QFileDevice::FileModificationTime).toMSecsSinceEpoch();
+    entry->preview = previewOf(bytes.constData(), bytes.size());
+  }
+
+  return file.commit();
+}
+
+// Appends a record to a file of records, at its known size. A record
+// which is not written whole is cut off, as a part of it would be read as
+// the next one.
+bool NoteFile::appendRecord(QFile& file, qint64& size, const QByteArray& record)
+{
+  if (!file.isOpen() || !file.seek(size)) return false;
+
+  if (file.write(record) != record.size()) {
+    file.resize(size);
+    return false;
+  }
+
+  size += record.size();
+  return true;
+}
+
+// A record torn by a crash ends a file of records. Whatever follows the
+// last whole record, which ends at end, is cut off so that the next
+// record is appended in its place. Returns true if anything was cut.
+bool NoteFile::cutOffTornRecord(QFile& file, qint64& size, qint64 end)
+{
+  if (end >= size) return false;
+
+  file.resize(end);
+  size = end;
+  return true;
+}
@@ -0,0 +1,48 @@
+// qMemo/notefile.hpp - reading of note files
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include "fileindex.hpp"
+
+
+
+// Stateless helpers, safe to call from worker threads.
+class NoteFile
+{
+public:
+  static bool appendRecord(QFile& file, qint64& size, const QByteArray& record);
+  static bool cutOffTornRecord(QFile& file, qint64& size, qint64 end);
+  static QString decode(const char* data, int size);
+  static QByteArray hash(const QString& text);
+  static QString load(const QString& path);
+  static QByteArray preview(const QString& path);
+  static QByteArray previewOf(const char* data, int size);
+  static bool save(const QString& path, const QString& text, IndexEntry* entry = nullptr);
+
+private:
+  static int collapseSpaces(const char* data, int size, char* out);
+  static int completeLength(const char* data, int size);
+
+  static const int MAX_LENGTH_OF_PREVIEW;
+  static const int PREVIEW_BYTES;
+};
@@ -0,0 +1,638 @@
+// qMemo/notehistory.cpp - saved versions of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "notehistory.hpp"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QMultiMap>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include "notefile.hpp"
+
+
+const QString NoteHistory::CHUNK_FILE { "chunks" };
+const QString NoteHistory::VERSION_FILE { "versions" };
+const int NoteHistory::MIN_CHUNK_SIZE { 512 };
+const int NoteHistory::MAX_CHUNK_SIZE { 16 << 10 };
+// eleven bits, so a boundary comes about every 2 KiB after the minimum
+const quint64 NoteHistory::BOUNDARY_MASK { 0xffe0000000000000ULL };
+const int NoteHistory::CHUNK_HEADER_SIZE { 12 }; // the id and the length
+const qint64 NoteHistory::HOUR { 60 * 60 * 1000 };
+const qint64 NoteHistory::DAY { 24 * 60 * 60 * 1000 };
+const qint64 NoteHistory::MAX_HISTORY_SIZE { 64 << 20 };
+const qint64 NoteHistory::COMPACT_SIZE { 4 << 20 };
+
+NoteHistory::NoteHistory()
+  : mNoteDirectory(), mChunkPath(), mVersionPath(), mIsOpen(false),
+    mChunkFile(), mVersionFile(), mChunkSize(0), mVersionSize(0),
+    mUnusedSize(0), mVersionCount(0), mRecordCount(0), mVersions(), mUses(), mChunks()
+{
+}
+
+void NoteHistory::setLocation(const QDir& noteDirectory, const QDir& dir)
+{
+  mNoteDirectory = noteDirectory;
+  mChunkPath = dir.filePath(CHUNK_FILE);
+  mVersionPath = dir.filePath(VERSION_FILE);
+}
+
+// Random numbers for the bytes, made the same way on every run so that
+// the boundaries, and with them the stored chunks, never change.
+const QVector<quint64>& NoteHistory::gear()
+{
+  static const QVector<quint64> table { [] {
+      QVector<quint64> values(256);
+      quint64 state { 0x9e3779b97f4a7c15ULL };
+
+      for (auto& value : values) {
+	// splitmix64
+	quint64 z { state += 0x9e3779b97f4a7c15ULL };
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	value = z ^ (z >> 31);
+      }
+
+      return values;
+    }() };
+
+  return table;
+}
+
+// A boundary is put where the hash of the last 64 bytes has its top bits
+// clear, so it depends on the text around it and not on its offset, and
+// an insertion moves the boundaries after it along with the text.
+QVector<QByteArray> NoteHistory::split(const QByteArray& bytes)
+{
+  const QVector<quint64>& table { gear() };
+  QVector<QByteArray> chunks;
+  int start { 0 };
+  quint64 hash { 0 };
+
+  for (int i { 0 }; i < bytes.size(); ++i) {
+    hash = (hash << 1) + table[static_cast<unsigned char>(bytes[i])];
+    int length { i - start + 1 };
+
+    if ((length >= MIN_CHUNK_SIZE && (hash & BOUNDARY_MASK) == 0) || length >= MAX_CHUNK_SIZE) {
+      chunks.append(bytes.mid(start, length));
+      start = i + 1;
+      hash = 0;
+    }
+  }
+
+  if (start < bytes.size()) chunks.append(bytes.mid(start));
+
+  return chunks;
+}
+
+// Notes are named by their paths relative to the note directory, as in
+// PackedStore.
+QString NoteHistory::keyOf(const QString& path) const
+{
+  return mNoteDirectory.relativeFilePath(path);
+}
+
+QByteArray NoteHistory::versionRecordOf(const QString& key, const Version& version)
+{
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(VersionRecord) << key << version.time << static_cast<quint32>(version.chunks.count());
+
+  for (const auto& chunk : version.chunks) {
+    out << chunk.id << chunk.offset << chunk.length;
+  }
+
+  return record;
+}
+
+// The files are opened, and the versions read, on the first use, which
+// happens on the thread of the file worker like every other.
+bool NoteHistory::open()
+{
+  if (mIsOpen) return true;
+
+  if (mChunkPath.isEmpty()) return false;
+
+  mChunkFile.setFileName(mChunkPath);
+  mVersionFile.setFileName(mVersionPath);
+
+  if (!mChunkFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered) ||
+      !mVersionFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+    qCritical("Failed to open the history: NoteHistory::open()");
+    mChunkFile.close();
+    mVersionFile.close();
+    return false;
+  }
+
+  mChunkSize = mChunkFile.size();
+  mVersionSize = mVersionFile.size();
+  mVersions.clear();
+  mUses.clear();
+  mChunks.clear();
+  mVersionCount = 0;
+  mRecordCount = 0;
+  readVersions();
+  mIsOpen = true;
+  return true;
+}
+
+// The versions are thinned here as well. Thinning keeps the last version
+// of an hour or a day, whose place only gets coarser with age, so the
+// versions dropped by record() stay dropped. A chunk torn by a crash is
+// used by no version, and is given back by the next compaction.
+void NoteHistory::readVersions()
+{
+  QDataStream in { &mVersionFile };
+  in.setVersion(QDataStream::Qt_5_0);
+  qint64 end { 0 };
+
+  while (!in.atEnd()) {
+    quint8 type;
+    QString key;
+    in >> type >> key;
+
+    if (type == VersionRecord) {
+      Version version;
+      quint32 count;
+      in >> version.time >> count;
+
+      // a chunk takes 20 bytes in the record
+      if (in.status() != QDataStream::Ok || count > (mVersionSize - mVersionFile.pos()) / 20) break;
+
+      version.chunks.resize(static_cast<int>(count));
+
+      for (auto& chunk : version.chunks) {
+	in >> chunk.id >> chunk.offset >> chunk.length;
+      }
+
+      if (in.status() != QDataStream::Ok) break;
+
+      mVersions[key].append(version);
+    } else if (type == RenameRecord) {
+      QString newKey;
+      in >> newKey;
+
+      if (in.status() != QDataStream::Ok) break;
+
+      if (mVersions.contains(key)) mVersions.insert(newKey, mVersions.take(key));
+    } else if (type == RemoveRecord) {
+      if (in.status() != QDataStream::Ok) break;
+
+      mVersions.remove(key);
+    } else {
+      break;
+    }
+
+    end = mVersionFile.pos();
+    ++mRecordCount;
+  }
+
+  if (NoteFile::cutOffTornRecord(mVersionFile, mVersionSize, end)) {
+    qCritical("Cut off a broken record: NoteHistory::readVersions()");
+  }
+
+  qint64 now { QDateTime::currentMSecsSinceEpoch() };
+  qint64 usedSize { 0 };
+
+  for (auto& versions : mVersions) {
+    thin(versions, now);
+    mVersionCount += versions.count();
+
+    for (const auto& version : versions) {
+      retain(version);
+    }
+  }
+
+  for (const auto& use : mUses) {
+    usedSize += CHUNK_HEADER_SIZE + use.length;
+  }
+
+  mUnusedSize = mChunkSize - usedSize;
+  trimToSize();
+}
+
+// Goes from the newest version to the oldest, and keeps the first one in
+// every hour or day. Hours and days are counted from the epoch, so a
+// version keeps its hour and day as it ages. Returns the dropped ones.
+QVector<NoteHistory::Version> NoteHistory::thin(QVector<Version>& versions, qint64 now)
+{
+  QVector<Version> kept;
+  QVector<Version> dropped;
+  qint64 lastPeriod { -1 };
+
+  for (int i { versions.count() - 1 }; i >= 0; --i) {
+    const Version& version { versions.at(i) };
+    qint64 age { now - version.time };
+    // hours are even and days odd, so that they never match
+    qint64 period {
+      age < HOUR ? -1 :
+      age < DAY ? version.time / HOUR * 2 :
+      version.time / DAY * 2 + 1
+    };
+
+    if (period >= 0 && period == lastPeriod) {
+      dropped.append(version);
+    } else {
+      kept.append(version);
+      lastPeriod = period;
+    }
+  }
+
+  if (dropped.isEmpty()) return dropped;
+
+  std::reverse(kept.begin(), kept.end());
+  versions.swap(kept);
+  return dropped;
+}
+
+// The oldest version of all is dropped, one at a time, as long as the
+// chunks in use take too much.
+void NoteHistory::trimToSize()
+{
+  if (mChunkSize - mUnusedSize <= MAX_HISTORY_SIZE) return;
+
+  QMultiMap<qint64, QString> oldest; // the keys of the notes by the time of their first version
+
+  for (auto i { mVersions.constBegin() }; i != mVersions.constEnd(); ++i) {
+    if (i.value().count() > 1) oldest.insert(i.value().first().time, i.key());
+  }
+
+  while (mChunkSize - mUnusedSize > MAX_HISTORY_SIZE && !oldest.isEmpty()) {
+    QString key { oldest.first() };
+    oldest.erase(oldest.begin());
+    QVector<Version>& versions { mVersions[key] };
+    release(versions.first());
+    versions.removeFirst();
+    --mVersionCount;
+
+    if (versions.count() > 1) oldest.insert(versions.first().time, key);
+  }
+}
+
+// Chunks are counted by the versions of every note which use them. A
+// chunk which no version uses any more is left to compaction, and is
+// not found for new versions.
+void NoteHistory::retain(const Version& version)
+{
+  for (const auto& chunk : version.chunks) {
+    ChunkUse& use { mUses[chunk.offset] };
+    use.length = chunk.length;
+    ++use.count;
+
+    if (!mChunks.contains(chunk.id)) mChunks.insert(chunk.id, chunk);
+  }
+}
+
+void NoteHistory::release(const Version& version)
+{
+  for (const auto& chunk : version.chunks) {
+    auto use { mUses.find(chunk.offset) };
+
+    if (use == mUses.end() || --use.value().count > 0) continue;
+
+    mUnusedSize += CHUNK_HEADER_SIZE + use.value().length;
+    mUses.erase(use);
+    auto found { mChunks.find(chunk.id) };
+
+    if (found != mChunks.end() && found.value().offset == chunk.offset) mChunks.erase(found);
+  }
+}
+
+// Chunks written for a version which was not recorded are used by none.
+void NoteHistory::discard(const QVector<Chunk>& chunks)
+{
+  for (const auto& chunk : chunks) {
+    mUnusedSize += CHUNK_HEADER_SIZE + chunk.length;
+    mChunks.remove(chunk.id);
+  }
+}
+
+// Only the chunks which no note has yet are written. They are written
+// before the version which refers to them, so a crash between the two
+// leaves unused chunks but never a version without its text. A text
+// which is the same as the last version is not recorded again.
+bool NoteHistory::record(const QString& path, const QString& text)
+{
+  if (!open()) return false;
+
+  QString key { keyOf(path) };
+  QVector<Version>& versions { mVersions[key] };
+  Version version { QDateTime::currentMSecsSinceEpoch(), QVector<Chunk>() };
+  QVector<Chunk> written;
+
+  for (const auto& bytes : split(text.toUtf8())) {
+    quint64 id { qFromBigEndian<quint64>(QCryptographicHash::hash(bytes, QCryptographicHash::Sha1).constData()) };
+    auto found { mChunks.constFind(id) };
+
+    if (found != mChunks.constEnd()) {
+      version.chunks.append(found.value());
+      continue;
+    }
+
+    QByteArray data { qCompress(bytes) };
+    QByteArray record;
+    QDataStream out { &record, QIODevice::WriteOnly };
+    out.setVersion(QDataStream::Qt_5_0);
+    out << id << static_cast<quint32>(data.size());
+    // the compressed chunk ends the record
+    record.append(data);
+    Chunk chunk { id, mChunkSize + CHUNK_HEADER_SIZE, static_cast<quint32>(data.size()) };
+
+    if (!NoteFile::appendRecord(mChunkFile, mChunkSize, record)) {
+      qCritical("Failed to write a chunk: NoteHistory::record()");
+      discard(written);
+      return false;
+    }
+
+    mChunks.insert(id, chunk);
+    written.append(chunk);
+    version.chunks.append(chunk);
+  }
+
+  if (!versions.isEmpty() && versions.last().chunks == version.chunks) return true;
+
+  if (!NoteFile::appendRecord(mVersionFile, mVersionSize, versionRecordOf(key, version))) {
+    qCritical("Failed to write a version: NoteHistory::record()");
+    discard(written);
+    return false;
+  }
+
+  retain(version);
+  versions.append(version);
+  ++mVersionCount;
+  ++mRecordCount;
+
+  for (const auto& dropped : thin(versions, version.time)) {
+    release(dropped);
+    --mVersionCount;
+  }
+
+  trimToSize();
+  compactIfWasted();
+  return true;
+}
+
+// Returns the times of the versions of the note, oldest first.
+QVector<qint64> NoteHistory::versions(const QString& path)
+{
+  QVector<qint64> times;
+
+  if (!open()) return times;
+
+  for (const auto& version : mVersions.value(keyOf(path))) {
+    times.append(version.time);
+  }
+
+  return times;
+}
+
+// Returns the compressed text of a chunk, after checking that the chunk
+// file still has it at its place.
+QByteArray NoteHistory::readChunk(const Chunk& chunk)
+{
+  if (!mChunkFile.seek(chunk.offset - CHUNK_HEADER_SIZE)) return QByteArray();
+
+  QByteArray record { mChunkFile.read(CHUNK_HEADER_SIZE + chunk.length) };
+  QDataStream in { record };
+  in.setVersion(QDataStream::Qt_5_0);
+  quint64 id;
+  quint32 length;
+  in >> id >> length;
+
+  if (in.status() != QDataStream::Ok || id != chunk.id || length != chunk.length ||
+      record.size() != CHUNK_HEADER_SIZE + static_cast<int>(chunk.length)) return QByteArray();
+
+  return record.mid(CHUNK_HEADER_SIZE);
+}
+
+// A version is put together from its chunks, read at their places, so
+// its cost does not depend on how long the history is. Returns a null
+// string if the version is not found.
+QString NoteHistory::load(const QString& path, qint64 time)
+{
+  if (!open()) return QString();
+
+  for (const auto& version : mVersions.value(keyOf(path))) {
+    if (version.time != time) continue;
+
+    QByteArray bytes;
+
+    for (const auto& chunk : version.chunks) {
+      QByteArray data { readChunk(chunk) };
+
+      if (data.isEmpty()) {
+	qCritical("Lost a chunk: NoteHistory::load()");
+	return QString();
+      }
+
+      bytes.append(qUncompress(data));
+    }
+
+    return bytes.isEmpty() ? QString(QLatin1String("")) : QString::fromUtf8(bytes);
+  }
+
+  return QString();
+}
+
+// The history follows the note when it is moved, into the archive or out
+// of it.
+void NoteHistory::rename(const QString& path, const QString& newPath)
+{
+  if (!open()) return;
+
+  QString key { keyOf(path) };
+  QString newKey { keyOf(newPath) };
+
+  if (key == newKey || !mVersions.contains(key)) return;
+
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(RenameRecord) << key << newKey;
+
+  if (!NoteFile::appendRecord(mVersionFile, mVersionSize, record)) {
+    qCritical("Failed to write a record: NoteHistory::rename()");
+    return;
+  }
+
+  // the history of a note which had the new name before is replaced
+  QVector<Version> replaced { mVersions.take(newKey) };
+
+  for (const auto& version : replaced) {
+    release(version);
+  }
+
+  mVersionCount -= replaced.count();
+  mVersions.insert(newKey, mVersions.take(key));
+  ++mRecordCount;
+  compactIfWasted();
+}
+
+void NoteHistory::remove(const QString& path)
+{
+  if (!open()) return;
+
+  QString key { keyOf(path) };
+
+  if (!mVersions.contains(key)) return;
+
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(RemoveRecord) << key;
+
+  if (!NoteFile::appendRecord(mVersionFile, mVersionSize, record)) {
+    qCritical("Failed to write a record: NoteHistory::remove()");
+    return;
+  }
+
+  QVector<Version> removed { mVersions.take(key) };
+
+  for (const auto& version : removed) {
+    release(version);
+  }
+
+  mVersionCount -= removed.count();
+  ++mRecordCount;
+  compactIfWasted();
+}
+
+// The files are compacted once most of either is no longer used.
+void NoteHistory::compactIfWasted()
+{
+  bool isChunkFileWasted { mChunkSize >= COMPACT_SIZE && mUnusedSize * 2 >= mChunkSize };
+  bool isVersionFileWasted { mVersionSize >= COMPACT_SIZE && mRecordCount >= 2 * mVersionCount };
+
+  if (isChunkFileWasted || isVersionFileWasted) compact();
+}
+
+// The used chunks and the kept versions are copied to new files, which
+// replace the old ones, the chunk file first. A crash between the two
+// leaves versions whose chunks readChunk() does not find, rather than
+// wrong texts.
+void NoteHistory::compact()
+{
+  QSaveFile chunkFile { mChunkPath };
+  QSaveFile versionFile { mVersionPath };
+
+  if (!chunkFile.open(QIODevice::WriteOnly) || !versionFile.open(QIODevice::WriteOnly)) {
+    qCritical("Failed to compact: NoteHistory::compact()");
+    return;
+  }
+
+  QHash<QString, QVector<Version>> notes;
+  QHash<qint64, qint64> offsets; // new ones by old ones, for all notes
+  qint64 chunkSize { 0 };
+  int versionCount { 0 };
+  bool isDone { true };
+
+  for (auto i { mVersions.constBegin() }; isDone && i != mVersions.constEnd(); ++i) {
+    QVector<Version>& versions { notes[i.key()] };
+
+    for (const auto& version : i.value()) {
+      Version copy { version.time, QVector<Chunk>() };
+      bool isLost { false };
+
+      for (const auto& chunk : version.chunks) {
+	auto found { offsets.constFind(chunk.offset) };
+
+	if (found == offsets.constEnd()) {
+	  QByteArray data { readChunk(chunk) };
+
+	  if (data.isEmpty()) {
+	    isLost = true;
+	    break;
+	  }
+
+	  QByteArray record;
+	  QDataStream out { &record, QIODevice::WriteOnly };
+	  out.setVersion(QDataStream::Qt_5_0);
+	  out << chunk.id << chunk.length;
+	  record.append(data);
+	  isDone = isDone && chunkFile.write(record) == record.size();
+	  found = offsets.insert(chunk.offset, chunkSize + CHUNK_HEADER_SIZE);
+	  chunkSize += record.size();
+	}
+
+	copy.chunks.append(Chunk { chunk.id, found.value(), chunk.length });
+      }
+
+      // a version which lost a chunk cannot be loaded any more
+      if (isLost) {
+	qCritical("Dropped a broken version: NoteHistory::compact()");
+	continue;
+      }
+
+      QByteArray record { versionRecordOf(i.key(), copy) };
+      isDone = isDone && versionFile.write(record) == record.size();
+      versions.append(copy);
+      ++versionCount;
+    }
+  }
+
+  if (!isDone) {
+    // the new files are dropped with the temporary ones
+    qCritical("Failed to compact: NoteHistory::compact()");
+    return;
+  }
+
+  mChunkFile.close();
+  mVersionFile.close();
+  bool isChunkFileReplaced { chunkFile.commit() };
+  isDone = isChunkFileReplaced && versionFile.commit();
+
+  if (!mChunkFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered) ||
+      !mVersionFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+    qCritical("Failed to open the history: NoteHistory::compact()");
+    mChunkFile.close();
+    mVersionFile.close();
+    mIsOpen = false;
+    return;
+  }
+
+  if (isChunkFileReplaced) {
+    // the versions in memory follow the chunk file
+    mVersions.swap(notes);
+    mUses.clear();
+    mChunks.clear();
+
+    for (const auto& versions : mVersions) {
+      for (const auto& version : versions) {
+	retain(version);
+      }
+    }
+
+    mUnusedSize = 0;
+    mVersionCount = versionCount;
+    mRecordCount = versionCount;
+  }
+
+  mChunkSize = mChunkFile.size();
+  mVersionSize = mVersionFile.size();
+
+  if (!isDone) {
+    qCritical("Failed to compact: NoteHistory::compact()");
+    return;
+  }
+
+  qInfo("Compacted the history: NoteHistory::compact()");
+}
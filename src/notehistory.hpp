@@ -0,0 +1,123 @@
+// qMemo/notehistory.hpp - saved versions of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+
+// Every saved text of a note is split into chunks at boundaries found by
+// the content, so an edit changes only the chunks around it. A chunk
+// which any version of any note has already is not stored again, and a
+// version is the list of the places of its chunks, so the history grows
+// with the edited bytes rather than with the size of the note, and a
+// copied note shares the chunks of the original. The
+// versions are read when the history is first used; the chunks stay on
+// disk. A note keeps every version of the last hour, the last one of
+// every hour of the last day, and the last one of every day before. The
+// oldest versions of all notes are dropped while the chunks take more
+// than MAX_HISTORY_SIZE, though never the last version of a note. The
+// space of the chunks no version uses any more is given back by
+// compaction. The history is used on the thread of the file worker only.
+class NoteHistory
+{
+public:
+  NoteHistory();
+  NoteHistory(const NoteHistory& other) = delete;
+  NoteHistory& operator=(const NoteHistory& other) = delete;
+
+  QString load(const QString& path, qint64 time);
+  bool record(const QString& path, const QString& text);
+  void remove(const QString& path);
+  void rename(const QString& path, const QString& newPath);
+  void setLocation(const QDir& noteDirectory, const QDir& dir);
+  QVector<qint64> versions(const QString& path);
+
+  static QVector<QByteArray> split(const QByteArray& bytes);
+
+private:
+  struct Chunk
+  {
+    quint64 id; // the head of the SHA-1 of the text
+    qint64 offset; // of the compressed text in the chunk file
+    quint32 length; // compressed
+
+    bool operator==(const Chunk& other) const { return offset == other.offset; }
+  };
+
+  struct ChunkUse
+  {
+    quint32 length; // compressed
+    int count; // of the versions which use the chunk
+  };
+
+  struct Version
+  {
+    qint64 time;
+    QVector<Chunk> chunks;
+  };
+
+  enum RecordType : quint8 { VersionRecord = 1, RenameRecord = 2, RemoveRecord = 3 };
+
+  void compact();
+  void compactIfWasted();
+  void discard(const QVector<Chunk>& chunks);
+  static const QVector<quint64>& gear();
+  QString keyOf(const QString& path) const;
+  bool open();
+  QByteArray readChunk(const Chunk& chunk);
+  void readVersions();
+  void release(const Version& version);
+  void retain(const Version& version);
+  void trimToSize();
+
+  static QVector<Version> thin(QVector<Version>& versions, qint64 now);
+  static QByteArray versionRecordOf(const QString& key, const Version& version);
+
+  QDir mNoteDirectory;
+  QString mChunkPath;
+  QString mVersionPath;
+  bool mIsOpen;
+  QFile mChunkFile;
+  QFile mVersionFile;
+  qint64 mChunkSize;
+  qint64 mVersionSize;
+  qint64 mUnusedSize; // of the chunks which no version uses
+  int mVersionCount;
+  int mRecordCount;
+  QHash<QString, QVector<Version>> mVersions;
+  QHash<qint64, ChunkUse> mUses; // by the offset of the chunk
+  QHash<quint64, Chunk> mChunks; // the used ones by their ids
+
+  static const QString CHUNK_FILE;
+  static const QString VERSION_FILE;
+  static const int MIN_CHUNK_SIZE;
+  static const int MAX_CHUNK_SIZE;
+  static const quint64 BOUNDARY_MASK;
+  static const int CHUNK_HEADER_SIZE;
+  static const qint64 HOUR;
+  static const qint64 DAY;
+  static const qint64 MAX_HISTORY_SIZE;
+  static const qint64 COMPACT_SIZE;
+};
@@ -0,0 +1,78 @@
+// qMemo/notestore.cpp - storage of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "notestore.hpp"
+
+#include "directorystore.hpp"
+#include "packedstore.hpp"
+
+
+NoteStore::~NoteStore()
+{
+}
+
+QVector<bool> NoteStore::moveAll(const QStringList& paths, const QStringList& newPaths)
+{
+  QVector<bool> isDone;
+  isDone.reserve(paths.count());
+
+  for (int i { 0 }; i < paths.count(); ++i) {
+    isDone.append(move(paths.at(i), newPaths.at(i)));
+  }
+
+  return isDone;
+}
+
+QVector<bool> NoteStore::removeAll(const QStringList& paths)
+{
+  QVector<bool> isDone;
+  isDone.reserve(paths.count());
+
+  for (const auto& path : paths) {
+    isDone.append(remove(path));
+  }
+
+  return isDone;
+}
+
+// The first note directory holds the others. Without a type, the store
+// whose data is in the data directory is opened, so the choice lasts
+// between sessions. A packed store writes its notes back to files when
+// the directory store is chosen again, and stays if it cannot. Returns
+// nullptr for an unknown type.
+NoteStore* NoteStore::create(const QString& type, const QList<QDir>& noteDirectories, const QDir& dataDirectory)
+{
+  bool isPacked { PackedStore::isIn(dataDirectory) };
+  QString chosen { type.isEmpty() ? (isPacked ? "packed" : "directory") : type };
+
+  if (chosen == "directory" && isPacked && !PackedStore(noteDirectories, dataDirectory).unpack()) {
+    qCritical("Failed to write the notes back to files: NoteStore::create()");
+    chosen = "packed";
+  }
+
+  return
+    chosen == "directory" ? static_cast<NoteStore*>(new DirectoryStore) :
+    chosen == "packed" ? static_cast<NoteStore*>(new PackedStore(noteDirectories, dataDirectory)) :
+    nullptr;
+}
+
+QStringList NoteStore::types()
+{
+  return { "directory", "packed" };
+}
@@ -0,0 +1,58 @@
+// qMemo/notestore.hpp - storage of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "fileindex.hpp"
+
+
+// Keeps the texts of notes. A note is named by the path of its file in
+// the note directories whether or not the store keeps such a file, so
+// the lists, the indexes and the journal work alike on every store.
+// Every method may be called from any thread. The batch methods return
+// whether each note was done; stores which can do a batch at once
+// override them.
+class NoteStore
+{
+public:
+  virtual ~NoteStore();
+
+  virtual bool exists(const QString& path) const = 0;
+  virtual bool hasNoteFiles() const = 0;
+  virtual QVector<IndexEntry> list(const QDir& dir, const FileIndex* cache = nullptr) const = 0;
+  virtual QString load(const QString& path) const = 0;
+  virtual qint64 modified(const QString& path) const = 0;
+  virtual bool move(const QString& path, const QString& newPath) = 0;
+  virtual QVector<bool> moveAll(const QStringList& paths, const QStringList& newPaths);
+  virtual QByteArray preview(const QString& path) const = 0;
+  virtual QByteArray read(const QString& path) const = 0;
+  virtual bool remove(const QString& path) = 0;
+  virtual QVector<bool> removeAll(const QStringList& paths);
+  virtual bool save(const QString& path, const QString& text, IndexEntry* entry = nullptr) = 0;
+  virtual qint64 size(const QString& path) const = 0;
+  virtual bool write(const QString& path, const QByteArray& bytes, qint64 modified) = 0;
+
+  static NoteStore* create(const QString& type, const QList<QDir>& noteDirectories, const QDir& dataDirectory);
+  static QStringList types();
+};
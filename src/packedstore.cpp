@@ -0,0 +1,617 @@
+// qMemo/packedstore.cpp - notes kept in a single data file
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "packedstore.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include "directorystore.hpp"
+#include "notefile.hpp"
+
+
+const quint32 PackedStore::MAGIC { 0x514d504b }; // "QMPK"
+const quint32 PackedStore::INDEX_MAGIC { 0x514d5049 }; // "QMPI"
+const quint32 PackedStore::VERSION { 1 };
+const qint64 PackedStore::HEADER_SIZE { 16 };
+const qint64 PackedStore::COMPACT_SIZE { 16 << 20 };
+const int PackedStore::HEAD_SIZE { 4096 };
+const QString PackedStore::PACK_FILE { "notes.pack" };
+const QString PackedStore::INDEX_FILE { "notes.packindex" };
+const QString PackedStore::UNPACKED_FILE { "notes.pack.unpacked" };
+const QString PackedStore::IMPORT_DIRECTORY { "imported" };
+
+PackedStore::PackedStore(const QList<QDir>& noteDirectories, const QDir& dataDirectory)
+  : NoteStore(), mNoteDirectory(noteDirectories.first()), mImportDirectories(noteDirectories),
+    mPackPath(dataDirectory.filePath(PACK_FILE)), mIndexPath(dataDirectory.filePath(INDEX_FILE)),
+    mMutex(), mPack(), mPackId(0), mPackSize(0), mLiveSize(0), mSlots(), mCompaction()
+{
+  if (!open()) {
+    qCritical("Failed to open the data file: PackedStore::PackedStore()");
+  }
+}
+
+PackedStore::~PackedStore()
+{
+  mCompaction.waitForFinished();
+
+  QMutexLocker locker { &mMutex };
+
+  if (mPack.isOpen()) writeIndex();
+}
+
+// The data file starts with its magic number and an id, which the index
+// file repeats, so an index of another data file is never trusted.
+QByteArray PackedStore::headerOf(qint64 id)
+{
+  QByteArray header;
+  QDataStream out { &header, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << MAGIC << VERSION << id;
+
+  return header;
+}
+
+QByteArray PackedStore::putRecordOf(const QString& key, qint64 modified, const QByteArray& bytes)
+{
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(PutRecord) << key << modified << static_cast<quint32>(bytes.size());
+  // the text ends the record
+  record.append(bytes);
+
+  return record;
+}
+
+QByteArray PackedStore::removeRecordOf(const QString& key)
+{
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(RemoveRecord) << key;
+
+  return record;
+}
+
+QByteArray PackedStore::moveRecordOf(const QString& key, const QString& newKey)
+{
+  QByteArray record;
+  QDataStream out { &record, QIODevice::WriteOnly };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << static_cast<quint8>(MoveRecord) << key << newKey;
+
+  return record;
+}
+
+bool PackedStore::open()
+{
+  bool isNew { !QFileInfo::exists(mPackPath) };
+  mPack.setFileName(mPackPath);
+
+  if (!mPack.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) return false;
+
+  if (isNew || mPack.size() == 0) {
+    mPackId = QDateTime::currentMSecsSinceEpoch();
+    QByteArray header { headerOf(mPackId) };
+
+    if (mPack.write(header) != header.size()) {
+      mPack.close();
+      return false;
+    }
+
+    mPackSize = header.size();
+    writeIndex();
+  } else {
+    QDataStream in { &mPack };
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic;
+    quint32 version;
+    in >> magic >> version >> mPackId;
+
+    if (in.status() != QDataStream::Ok || magic != MAGIC || version != VERSION) {
+      mPack.close();
+      return false;
+    }
+
+    mPackSize = mPack.size();
+    qint64 covered { readIndex() };
+    // records which the index does not cover are read from the data file
+    replay(covered < 0 ? HEADER_SIZE : covered);
+  }
+
+  importNotes();
+  return true;
+}
+
+// Only the listed note directories are imported. A file is put into the
+// data file unless a later version of its note is there already. The
+// files are read back from the data file, and only then moved into the
+// data directory, so that they are not taken for notes again, by this
+// store or another one. A file which fails the check stays, and is
+// imported again by the next session.
+void PackedStore::importNotes()
+{
+  QHash<QString, QByteArray> imported; // by key
+  QStringList outdated;
+
+  for (const auto& dir : mImportDirectories) {
+    for (const auto& fileInfo : dir.entryInfoList(QDir::Files)) {
+      QString key { keyOf(fileInfo.filePath()) };
+      qint64 modified { fileInfo.lastModified().toMSecsSinceEpoch() };
+      auto found { mSlots.constFind(key) };
+
+      if (found != mSlots.constEnd() && found.value().modified >= modified) {
+	outdated.append(key);
+	continue;
+      }
+
+      QByteArray bytes { NoteFile::load(fileInfo.filePath()).toUtf8() };
+
+      if (put(key, bytes, modified)) {
+	imported.insert(key, bytes);
+      } else {
+	qCritical("Failed to import a note: PackedStore::importNotes()");
+      }
+    }
+  }
+
+  // the data file is written straight through, so the notes are in it
+  if (!imported.isEmpty() && !writeIndex()) return;
+
+  for (auto i { imported.constBegin() }; i != imported.constEnd(); ++i) {
+    if (readText(mPack, mSlots.value(i.key())) == i.value()) {
+      outdated.append(i.key());
+    } else {
+      qCritical("Failed to check an imported note: PackedStore::importNotes()");
+    }
+  }
+
+  QDir importDirectory { QFileInfo(mPackPath).dir().filePath(IMPORT_DIRECTORY) };
+
+  for (const auto& key : outdated) {
+    QString target { importDirectory.filePath(key) };
+
+    // an older copy of the same note is replaced
+    if (QFile::exists(target)) QFile::remove(target);
+
+    if (!importDirectory.mkpath(QFileInfo(target).path()) || !QFile::rename(mNoteDirectory.filePath(key), target)) {
+      qCritical("Failed to move an imported note: PackedStore::importNotes()");
+    }
+  }
+}
+
+// Every note is written to its file with its time, and the data file is
+// then set aside, so that a packed store imports the files again.
+bool PackedStore::unpack()
+{
+  QMutexLocker locker { &mMutex };
+
+  if (!mPack.isOpen()) return false;
+
+  DirectoryStore files;
+
+  for (auto i { mSlots.constBegin() }; i != mSlots.constEnd(); ++i) {
+    QString path { mNoteDirectory.filePath(i.key()) };
+    QByteArray bytes { readText(mPack, i.value()) };
+
+    if (bytes.size() != i.value().length || !mNoteDirectory.mkpath(QFileInfo(path).path()) ||
+	!files.write(path, bytes, i.value().modified)) return false;
+  }
+
+  mPack.close();
+  QString unpackedPath { QFileInfo(mPackPath).dir().filePath(UNPACKED_FILE) };
+
+  if (QFile::exists(unpackedPath)) QFile::remove(unpackedPath);
+
+  return QFile::rename(mPackPath, unpackedPath) && (!QFile::exists(mIndexPath) || QFile::remove(mIndexPath));
+}
+
+bool PackedStore::isIn(const QDir& dataDirectory)
+{
+  return QFileInfo::exists(dataDirectory.filePath(PACK_FILE));
+}
+
+// Returns the end of the data file which the index covers, or -1 when
+// it cannot be used.
+qint64 PackedStore::readIndex()
+{
+  QFile file { mIndexPath };
+
+  if (!file.open(QIODevice::ReadOnly)) return -1;
+
+  QDataStream in { &file };
+  in.setVersion(QDataStream::Qt_5_0);
+  quint32 magic;
+  quint32 version;
+  qint64 id;
+  qint64 covered;
+  quint32 count;
+  in >> magic >> version >> id >> covered >> count;
+
+  if (in.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != VERSION ||
+      id != mPackId || covered < HEADER_SIZE || covered > mPackSize) return -1;
+
+  QHash<QString, Slot> slots;
+  slots.reserve(static_cast<int>(count));
+  qint64 liveSize { 0 };
+
+  for (quint32 i { 0 }; i < count; ++i) {
+    QString key;
+    Slot slot;
+    in >> key >> slot.offset >> slot.length >> slot.modified >> slot.preview;
+
+    if (in.status() != QDataStream::Ok) return -1;
+
+    slots.insert(key, slot);
+    liveSize += slot.length;
+  }
+
+  mSlots.swap(slots);
+  mLiveSize = liveSize;
+  return covered;
+}
+
+bool PackedStore::writeIndex() const
+{
+  QSaveFile file { mIndexPath };
+
+  if (!file.open(QIODevice::WriteOnly)) return false;
+
+  QDataStream out { &file };
+  out.setVersion(QDataStream::Qt_5_0);
+  out << INDEX_MAGIC << VERSION << mPackId << mPackSize << static_cast<quint32>(mSlots.count());
+
+  for (auto i { mSlots.constBegin() }; i != mSlots.constEnd(); ++i) {
+    out << i.key() << i.value().offset << i.value().length << i.value().modified << i.value().preview;
+  }
+
+  if (out.status() != QDataStream::Ok || !file.commit()) {
+    qCritical("Failed to write the index: PackedStore::writeIndex()");
+    return false;
+  }
+
+  return true;
+}
+
+// Reads the records from the given offset on.
+void PackedStore::replay(qint64 from)
+{
+  if (!mPack.seek(from)) return;
+
+  QDataStream in { &mPack };
+  in.setVersion(QDataStream::Qt_5_0);
+  qint64 end { from };
+
+  while (!in.atEnd()) {
+    quint8 type;
+    QString key;
+    in >> type >> key;
+
+    if (type == PutRecord) {
+      Slot slot;
+      quint32 length;
+      in >> slot.modified >> length;
+      slot.offset = mPack.pos();
+      slot.length = static_cast<qint32>(length);
+
+      if (in.status() != QDataStream::Ok || slot.offset + length > mPackSize) break;
+
+      QByteArray head { mPack.read(qMin(slot.length, HEAD_SIZE)) };
+      slot.preview = NoteFile::previewOf(head.constData(), head.size());
+      mLiveSize += slot.length - mSlots.value(key).length;
+      mSlots.insert(key, slot);
+      mPack.seek(slot.offset + length);
+    } else if (type == RemoveRecord) {
+      if (in.status() != QDataStream::Ok) break;
+
+      mLiveSize -= mSlots.take(key).length;
+    } else if (type == MoveRecord) {
+      QString newKey;
+      in >> newKey;
+
+      if (in.status() != QDataStream::Ok) break;
+
+      if (mSlots.contains(key)) mSlots.insert(newKey, mSlots.take(key));
+    } else {
+      break;
+    }
+
+    end = mPack.pos();
+  }
+
+  if (NoteFile::cutOffTornRecord(mPack, mPackSize, end)) {
+    qCritical("Cut off a broken record: PackedStore::replay()");
+  }
+}
+
+// Called with the lock held.
+bool PackedStore::put(const QString& key, const QByteArray& bytes, qint64 modified)
+{
+  QByteArray record { putRecordOf(key, modified, bytes) };
+  qint64 offset { mPackSize + record.size() - bytes.size() };
+
+  if (!NoteFile::appendRecord(mPack, mPackSize, record)) return false;
+
+  Slot slot { offset, bytes.size(), modified, NoteFile::previewOf(bytes.constData(), bytes.size()) };
+  mLiveSize += slot.length - mSlots.value(key).length;
+  mSlots.insert(key, slot);
+  return true;
+}
+
+QByteArray PackedStore::readText(QFile& pack, const Slot& slot)
+{
+  if (!pack.seek(slot.offset)) return QByteArray();
+
+  QByteArray bytes { pack.read(slot.length) };
+
+  return bytes.size() == slot.length ? bytes : QByteArray();
+}
+
+// Notes are named by their paths relative to the note directory, so the
+// data file does not depend on where the home directory is.
+QString PackedStore::keyOf(const QString& path) const
+{
+  return mNoteDirectory.relativeFilePath(path);
+}
+
+bool PackedStore::exists(const QString& path) const
+{
+  QMutexLocker locker { &mMutex };
+
+  return mSlots.contains(keyOf(path));
+}
+
+bool PackedStore::hasNoteFiles() const
+{
+  return false;
+}
+
+// The index of the directory is not needed, as the slots are in memory.
+QVector<IndexEntry> PackedStore::list(const QDir& dir, const FileIndex* cache) const
+{
+  Q_UNUSED(cache);
+
+  QString prefix { keyOf(dir.absolutePath()) };
+  prefix = prefix.isEmpty() || prefix == "." ? QString() : prefix + '/';
+  QVector<IndexEntry> entries;
+  QMutexLocker locker { &mMutex };
+
+  for (auto i { mSlots.constBegin() }; i != mSlots.constEnd(); ++i) {
+    if (i.key().startsWith(prefix) && i.key().indexOf('/', prefix.length()) < 0) {
+      entries.append(IndexEntry { i.key().mid(prefix.length()), i.value().length, i.value().modified, i.value().preview });
+    }
+  }
+
+  return entries;
+}
+
+QString PackedStore::load(const QString& path) const
+{
+  QByteArray bytes { read(path) };
+
+  return NoteFile::decode(bytes.constData(), bytes.size());
+}
+
+qint64 PackedStore::modified(const QString& path) const
+{
+  QMutexLocker locker { &mMutex };
+  auto found { mSlots.constFind(keyOf(path)) };
+
+  return found == mSlots.constEnd() ? -1 : found.value().modified;
+}
+
+QByteArray PackedStore::read(const QString& path) const
+{
+  QMutexLocker locker { &mMutex };
+  auto found { mSlots.constFind(keyOf(path)) };
+
+  if (found == mSlots.constEnd()) {
+    qCritical("Note wasn't found: PackedStore::read()");
+    return QByteArray();
+  }
+
+  return readText(mPack, found.value());
+}
+
+QByteArray PackedStore::preview(const QString& path) const
+{
+  QMutexLocker locker { &mMutex };
+
+  return mSlots.value(keyOf(path)).preview;
+}
+
+bool PackedStore::save(const QString& path, const QString& text, IndexEntry* entry)
+{
+  QByteArray bytes { text.toUtf8() };
+  qint64 modified { QDateTime::currentMSecsSinceEpoch() };
+  QMutexLocker locker { &mMutex };
+
+  if (!put(keyOf(path), bytes, modified)) return false;
+
+  if (entry) {
+    entry->fileName = QFileInfo(path).fileName();
+    entry->size = bytes.size();
+    entry->modified = modified;
+    entry->preview = mSlots.value(keyOf(path)).preview;
+  }
+
+  scheduleCompaction();
+  return true;
+}
+
+qint64 PackedStore::size(const QString& path) const
+{
+  QMutexLocker locker { &mMutex };
+  auto found { mSlots.constFind(keyOf(path)) };
+
+  return found == mSlots.constEnd() ? -1 : found.value().length;
+}
+
+bool PackedStore::write(const QString& path, const QByteArray& bytes, qint64 modified)
+{
+  QMutexLocker locker { &mMutex };
+
+  if (!put(keyOf(path), bytes, modified)) return false;
+
+  scheduleCompaction();
+  return true;
+}
+
+bool PackedStore::remove(const QString& path)
+{
+  QString key { keyOf(path) };
+  QMutexLocker locker { &mMutex };
+
+  if (!mSlots.contains(key) || !NoteFile::appendRecord(mPack, mPackSize, removeRecordOf(key))) return false;
+
+  mLiveSize -= mSlots.take(key).length;
+  scheduleCompaction();
+  return true;
+}
+
+// The text stays where it is, only its name changes.
+bool PackedStore::move(const QString& path, const QString& newPath)
+{
+  QString key { keyOf(path) };
+  QString newKey { keyOf(newPath) };
+  QMutexLocker locker { &mMutex };
+
+  if (!mSlots.contains(key) || mSlots.contains(newKey) || !NoteFile::appendRecord(mPack, mPackSize, moveRecordOf(key, newKey))) return false;
+
+  mSlots.insert(newKey, mSlots.take(key));
+  return true;
+}
+
+// Called with the lock held.
+void PackedStore::scheduleCompaction()
+{
+  if (mPackSize < COMPACT_SIZE || mLiveSize * 2 > mPackSize || mCompaction.isRunning()) return;
+
+  mCompaction = QtConcurrent::run(this, &PackedStore::compact);
+}
+
+// The live notes are copied to a new data file while notes are still
+// written to the old one. The notes written meanwhile are copied at the
+// end, under the lock, just before the new file replaces the old one.
+void PackedStore::compact()
+{
+  QHash<QString, Slot> slots;
+
+  {
+    QMutexLocker locker { &mMutex };
+    slots = mSlots;
+  }
+
+  QFile source { mPackPath };
+  QSaveFile target { mPackPath };
+
+  if (!source.open(QIODevice::ReadOnly) || !target.open(QIODevice::WriteOnly)) {
+    qCritical("Failed to compact: PackedStore::compact()");
+    return;
+  }
+
+  qint64 id { QDateTime::currentMSecsSinceEpoch() };
+  qint64 size { target.write(headerOf(id)) };
+  // the old offset of every copied text, with its name then and its new offset
+  QHash<qint64, QPair<QString, qint64>> copied;
+  bool isDone { size == HEADER_SIZE };
+
+  for (auto i { slots.constBegin() }; isDone && i != slots.constEnd(); ++i) {
+    QByteArray bytes { readText(source, i.value()) };
+    QByteArray record { putRecordOf(i.key(), i.value().modified, bytes) };
+    copied.insert(i.value().offset, qMakePair(i.key(), size + record.size() - bytes.size()));
+    isDone = bytes.size() == i.value().length && target.write(record) == record.size();
+    size += record.size();
+  }
+
+  QMutexLocker locker { &mMutex };
+  QHash<QString, Slot> newSlots;
+
+  for (auto i { mSlots.constBegin() }; isDone && i != mSlots.constEnd(); ++i) {
+    Slot slot { i.value() };
+    auto found { copied.constFind(slot.offset) };
+
+    if (found != copied.constEnd() && found.value().first == i.key()) {
+      slot.offset = found.value().second;
+    } else {
+      // written or moved since the copy started; a moved text is copied
+      // again, as a move record would depend on the order of the moves
+      QByteArray bytes { readText(source, slot) };
+
+      if (bytes.size() != slot.length) {
+	isDone = false;
+	break;
+      }
+
+      QByteArray record { putRecordOf(i.key(), slot.modified, bytes) };
+      slot.offset = size + record.size() - bytes.size();
+      isDone = target.write(record) == record.size();
+      size += record.size();
+    }
+
+    newSlots.insert(i.key(), slot);
+  }
+
+  for (auto i { copied.constBegin() }; isDone && i != copied.constEnd(); ++i) {
+    // a note saved again meanwhile has its new text put above
+    if (newSlots.contains(i.value().first)) continue;
+
+    // removed or moved since the copy started
+    QByteArray record { removeRecordOf(i.value().first) };
+    isDone = target.write(record) == record.size();
+    size += record.size();
+  }
+
+  source.close();
+
+  if (!isDone) {
+    // the new file is dropped with the temporary one
+    qCritical("Failed to compact: PackedStore::compact()");
+    return;
+  }
+
+  mPack.close();
+  isDone = target.commit();
+
+  if (!mPack.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+    qCritical("Failed to open the data file: PackedStore::compact()");
+  }
+
+  if (!isDone) {
+    qCritical("Failed to compact: PackedStore::compact()");
+    return;
+  }
+
+  qint64 liveSize { 0 };
+
+  for (const auto& slot : newSlots) {
+    liveSize += slot.length;
+  }
+
+  mSlots.swap(newSlots);
+  mPackId = id;
+  mPackSize = size;
+  mLiveSize = liveSize;
+  writeIndex();
+  qInfo("Compacted the data file: PackedStore::compact()");
+}
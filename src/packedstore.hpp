@@ -0,0 +1,110 @@
+// qMemo/packedstore.hpp - notes kept in a single data file
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QFile>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include "notestore.hpp"
+
+
+// Notes are appended to one data file and found by their offsets in it,
+// which an index file keeps between sessions. A save appends the note
+// again, so the data file is compacted in the background once most of
+// it is outdated. Note files found in the note directories are imported
+// whenever the store opens, and kept aside in the data directory once
+// the data file holds them. unpack() writes the notes back to files for
+// a return to the directory store.
+class PackedStore : public NoteStore
+{
+public:
+  PackedStore(const QList<QDir>& noteDirectories, const QDir& dataDirectory);
+  ~PackedStore() override;
+  PackedStore(const PackedStore& other) = delete;
+  PackedStore& operator=(const PackedStore& other) = delete;
+
+  bool exists(const QString& path) const override;
+  bool hasNoteFiles() const override;
+  QVector<IndexEntry> list(const QDir& dir, const FileIndex* cache = nullptr) const override;
+  QString load(const QString& path) const override;
+  qint64 modified(const QString& path) const override;
+  bool move(const QString& path, const QString& newPath) override;
+  QByteArray preview(const QString& path) const override;
+  QByteArray read(const QString& path) const override;
+  bool remove(const QString& path) override;
+  bool save(const QString& path, const QString& text, IndexEntry* entry = nullptr) override;
+  qint64 size(const QString& path) const override;
+  bool write(const QString& path, const QByteArray& bytes, qint64 modified) override;
+
+  bool unpack();
+
+  static bool isIn(const QDir& dataDirectory);
+
+private:
+  struct Slot
+  {
+    qint64 offset; // of the text in the data file
+    qint32 length;
+    qint64 modified;
+    QByteArray preview;
+  };
+
+  enum RecordType : quint8 { PutRecord = 1, RemoveRecord = 2, MoveRecord = 3 };
+
+  void compact();
+  void importNotes();
+  QString keyOf(const QString& path) const;
+  bool open();
+  bool put(const QString& key, const QByteArray& bytes, qint64 modified);
+  qint64 readIndex();
+  void replay(qint64 from);
+  void scheduleCompaction();
+  bool writeIndex() const;
+
+  static QByteArray headerOf(qint64 id);
+  static QByteArray moveRecordOf(const QString& key, const QString& newKey);
+  static QByteArray putRecordOf(const QString& key, qint64 modified, const QByteArray& bytes);
+  static QByteArray readText(QFile& pack, const Slot& slot);
+  static QByteArray removeRecordOf(const QString& key);
+
+  QDir mNoteDirectory;
+  QList<QDir> mImportDirectories;
+  QString mPackPath;
+  QString mIndexPath;
+  mutable QMutex mMutex;
+  mutable QFile mPack;
+  qint64 mPackId;
+  qint64 mPackSize;
+  qint64 mLiveSize;
+  QHash<QString, Slot> mSlots;
+  QFuture<void> mCompaction;
+
+  static const quint32 MAGIC;
+  static const quint32 INDEX_MAGIC;
+  static const quint32 VERSION;
+  static const qint64 HEADER_SIZE;
+  static const qint64 COMPACT_SIZE;
+  static const int HEAD_SIZE;
+  static const QString PACK_FILE;
+  static const QString INDEX_FILE;
+  static const QString UNPACKED_FILE;
+  static const QString IMPORT_DIRECTORY;
+};
@@ -0,0 +1,280 @@
+// qMemo/searchindex.cpp - full text index of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "searchindex.hpp"
+
+#include <QDir>
+#include <QtConcurrent>
+#include <algorithm>
+#include <iterator>
+#include "notestore.hpp"
+
+
+// shorter prefixes match too many words to answer while typing
+const int SearchIndex::MIN_PREFIX_LENGTH { 2 };
+const int SearchIndex::MIN_DEAD_IDS_TO_PURGE { 1024 };
+
+SearchIndex::SearchIndex()
+  : mIds(), mPaths(), mFreeIds(), mDeadIds(), mPostings()
+{
+}
+
+bool SearchIndex::isCjk(QChar c)
+{
+  ushort code { c.unicode() };
+
+  return
+    (code >= 0x3040 && code <= 0x30ff) || // hiragana, katakana and their marks
+    (code >= 0xff66 && code <= 0xff9f) || // halfwidth katakana
+    c.script() == QChar::Script_Han ||
+    c.script() == QChar::Script_Hangul;
+}
+
+// Returns the distinct tokens of text. If lastWord is given, a Latin word
+// at the very end of text is returned there instead of as a token, so that
+// a query can match it as a prefix while it is still being typed.
+QStringList SearchIndex::tokenize(const QString& text, QString* lastWord)
+{
+  QSet<QString> tokens;
+  int length { text.length() };
+  int i { 0 };
+
+  while (i < length) {
+    QChar c { text.at(i) };
+
+    if (isCjk(c)) {
+      int start { i };
+
+      while (i < length && isCjk(text.at(i))) ++i;
+
+      for (int j { start }; j < i; ++j) {
+	tokens.insert(text.mid(j, 1));
+
+	if (j + 1 < i) tokens.insert(text.mid(j, 2));
+      }
+    } else if (c.isLetterOrNumber()) {
+      int start { i };
+
+      while (i < length && text.at(i).isLetterOrNumber() && !isCjk(text.at(i))) ++i;
+
+      QString word { text.mid(start, i - start).toCaseFolded() };
+
+      if (lastWord && i == length) {
+	*lastWord = word;
+      } else {
+	tokens.insert(word);
+      }
+    } else {
+      ++i;
+    }
+  }
+
+  return tokens.values();
+}
+
+struct SearchIndex::Tokenizer
+{
+  typedef TokenizedNote result_type;
+
+  const NoteStore* store;
+
+  TokenizedNote operator()(const QPair<QString, QString>& note) const
+  {
+    // a null text means that the note is read from the store
+    if (!note.second.isNull()) {
+      return TokenizedNote { note.first, true, tokenize(note.second) };
+    }
+
+    if (!store->exists(note.first)) {
+      return TokenizedNote { note.first, false, QStringList() };
+    }
+
+    return TokenizedNote { note.first, true, tokenize(store->load(note.first)) };
+  }
+};
+
+QVector<TokenizedNote> SearchIndex::tokenizeNotes(const NoteStore* store, const QHash<QString, QString>& notes)
+{
+  QList<QPair<QString, QString>> list;
+  list.reserve(notes.count());
+
+  for (auto it { notes.constBegin() }; it != notes.constEnd(); ++it) {
+    list.append(qMakePair(it.key(), it.value()));
+  }
+
+  return QtConcurrent::blockingMapped<QVector<TokenizedNote>>(list, Tokenizer { store });
+}
+
+// Lists and indexes all notes in dirs, to be run in the background.
+SearchIndex SearchIndex::build(const NoteStore* store, const QStringList& dirs)
+{
+  QHash<QString, QString> notes;
+
+  for (const auto& path : dirs) {
+    QDir dir { path };
+
+    for (const auto& entry : store->list(dir)) {
+      notes.insert(dir.filePath(entry.fileName), QString());
+    }
+  }
+
+  SearchIndex index;
+  index.apply(tokenizeNotes(store, notes));
+
+  for (auto& ids : index.mPostings) {
+    ids.squeeze();
+  }
+
+  return index;
+}
+
+void SearchIndex::apply(const QVector<TokenizedNote>& notes)
+{
+  for (const auto& note : notes) {
+    if (note.exists) {
+      insert(note.path, note.tokens);
+    } else {
+      remove(note.path);
+    }
+  }
+
+  if (mDeadIds.count() >= qMax(MIN_DEAD_IDS_TO_PURGE, mIds.count() / 4)) purge();
+}
+
+void SearchIndex::insert(const QString& path, const QStringList& tokens)
+{
+  remove(path);
+
+  int id;
+
+  if (mFreeIds.isEmpty()) {
+    id = mPaths.count();
+    mPaths.append(path);
+  } else {
+    id = mFreeIds.takeLast();
+    mPaths[id] = path;
+  }
+
+  mIds.insert(path, id);
+
+  for (const auto& token : tokens) {
+    QVector<int>& ids { mPostings[token] };
+
+    // new ids are mostly the largest, which makes this an append
+    ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+  }
+}
+
+// The id of a removed note stays in the postings until the next purge,
+// and is skipped by search() meanwhile.
+void SearchIndex::remove(const QString& path)
+{
+  int id { mIds.value(path, -1) };
+
+  if (id < 0) return;
+
+  mIds.remove(path);
+  mPaths[id].clear();
+  mDeadIds.append(id);
+}
+
+// Sweeps removed notes out of all postings, after which their ids are
+// free to be reused.
+void SearchIndex::purge()
+{
+  auto isDead { [this](int id) { return mPaths.at(id).isEmpty(); } };
+
+  for (auto it { mPostings.begin() }; it != mPostings.end();) {
+    QVector<int>& ids { it.value() };
+    ids.erase(std::remove_if(ids.begin(), ids.end(), isDead), ids.end());
+
+    if (ids.isEmpty()) {
+      it = mPostings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  mFreeIds += mDeadIds;
+  mDeadIds.clear();
+}
+
+void SearchIndex::rename(const QString& oldPath, const QString& newPath)
+{
+  int id { mIds.value(oldPath, -1) };
+
+  if (id < 0) return;
+
+  mIds.remove(oldPath);
+  mIds.insert(newPath, id);
+  mPaths[id] = newPath;
+}
+
+QVector<int> SearchIndex::lookUpPrefix(const QString& prefix) const
+{
+  QVector<int> ids;
+
+  for (auto it { mPostings.lowerBound(prefix) }; it != mPostings.constEnd() && it.key().startsWith(prefix); ++it) {
+    ids += it.value();
+  }
+
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+QSet<QString> SearchIndex::search(const QString& query) const
+{
+  QString lastWord;
+  QStringList tokens { tokenize(query, &lastWord) };
+  QVector<QVector<int>> matches;
+
+  for (const auto& token : tokens) {
+    matches.append(mPostings.value(token));
+  }
+
+  if (!lastWord.isEmpty()) {
+    matches.append(lastWord.length() < MIN_PREFIX_LENGTH ? mPostings.value(lastWord) : lookUpPrefix(lastWord));
+  }
+
+  QSet<QString> paths;
+
+  if (matches.isEmpty()) return paths;
+
+  // intersect starting from the rarest token
+  std::sort(matches.begin(), matches.end(),
+	    [](const QVector<int>& a, const QVector<int>& b) { return a.count() < b.count(); });
+  QVector<int> ids { matches.first() };
+
+  for (int i { 1 }; i < matches.count() && !ids.isEmpty(); ++i) {
+    QVector<int> common;
+    common.reserve(ids.count());
+    std::set_intersection(ids.constBegin(), ids.constEnd(), matches.at(i).constBegin(), matches.at(i).constEnd(),
+			  std::back_inserter(common));
+    ids.swap(common);
+  }
+
+  for (int id : ids) {
+    const QString& path { mPaths.at(id) };
+
+    if (!path.isEmpty()) paths.insert(path);
+  }
+
+  return paths;
+}
@@ -0,0 +1,77 @@
+// qMemo/searchindex.hpp - full text index of notes
+// qMemo is a note taking application
+//
+//  Copyright (C) 2019  Yasuhiro Yamakawa <kawatab@yahoo.co.jp>
+//
+//  This program is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or any
+//  later version.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT
+//  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+//  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+//  License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class NoteStore;
+
+
+struct TokenizedNote
+{
+  QString path;
+  bool exists;
+  QStringList tokens;
+};
+
+
+// Inverted index from tokens to notes. Latin text is split into case
+// folded words, Japanese, Chinese and Korean text into single characters
+// and bigrams, as it has no spaces between words. A posting is a sorted
+// vector of note ids; removed notes are swept out of the postings in
+// batches, so the tokens of each note need not be kept.
+class SearchIndex
+{
+public:
+  SearchIndex();
+
+  void apply(const QVector<TokenizedNote>& notes);
+  void remove(const QString& path);
+  void rename(const QString& oldPath, const QString& newPath);
+  QSet<QString> search(const QString& query) const;
+
+  static QStringList tokenize(const QString& text, QString* lastWord = nullptr);
+  static QVector<TokenizedNote> tokenizeNotes(const NoteStore* store, const QHash<QString, QString>& notes);
+  static SearchIndex build(const NoteStore* store, const QStringList& dirs);
+
+private:
+  struct Tokenizer;
+
+  void insert(const QString& path, const QStringList& tokens);
+  void purge();
+  QVector<int> lookUpPrefix(const QString& prefix) const;
+
+  static bool isCjk(QChar c);
+
+  QHash<QString, int> mIds;
+  QVector<QString> mPaths;
+  QVector<int> mFreeIds;
+  QVector<int> mDeadIds;
+  QMap<QString, QVector<int>> mPostings;
+
+  static const int MIN_PREFIX_LENGTH;
+  static const int MIN_DEAD_IDS_TO_PURGE;
+};